@@ -25,21 +25,35 @@ def application(env,start_response):
 	#than what is passed in the header
 	boundary = '--' + contentType[offset + len(magic):]
 	
-	for headers, data in multipart.Parser(boundary,env['wsgi.input']):
-		#headers is an iterator returning tuples of the form
-		# (name, value)
-		
-		#data is an iterator return chunks of data from this part
-		
+	#wsgi.input is read in blocks, so tell the parser where the body
+	#ends or it would wait on the socket for more data
+	length = int(env.get('CONTENT_LENGTH') or 0) or None
+	
+	#The data of each part is written to its file by the parser itself,
+	#without passing through Python. The parser is done with a part's
+	#file by the time the next part starts, so only one is open at once.
+	files = []
+	def sink(headers):
 		global filenumber
+		if files:
+			files.pop().close()
 		filename = 'savedfile_%i' % filenumber
 		filenumber += 1
-		with open(filename,'w') as fout:
-			for chunk in data:
-				fout.write(chunk)
-				
-		print 'saved file:%s' % filename
-				
+		files.append(open(filename,'wb'))
+		print 'saving file:%s' % filename
+		return files[-1]
+	
+	try:
+		for headers, data in multipart.Parser(boundary,env['wsgi.input'],content_length=length,sink=sink):
+			#headers is an iterator returning tuples of the form
+			# (name, value)
+			
+			#data is empty, since the sink received all of it
+			pass
+	finally:
+		#The last file, or the one open when parsing failed
+		for fout in files:
+			fout.close()
 	
 	status = '200 OK'
 	msg = 'Uploaded ok!'
@@ -7,13 +7,19 @@
 #include "string.h"
 #include "multipart_Parser.h"
 #include "multipart_Generator.h"
+#include "multipart_Headers.h"
+#include "multipart_parse.h"
+#include "multipart_PushParser.h"
+#include "multipart_Encoder.h"
 
 PyObject * multipartModule = NULL;
 
 
 
 static PyMethodDef multipart_methods[] = {
-	
+	{"parse_all",(PyCFunction)multipart_parse_all,METH_VARARGS|METH_KEYWORDS,"parse_all(boundary, body)\n\nParses a body that is already in memory in one pass on this thread and\nreturns a list of (headers, data) tuples, where headers is a list of\n(name, value) tuples and data is a string."},
+	{"parse_many",(PyCFunction)multipart_parse_many,METH_VARARGS|METH_KEYWORDS,"parse_many(items, workers=0)\n\nParses each (boundary, body) tuple in items on a pool of native threads and\nreturns a list with the parts of each body, as lists of (headers, data)\ntuples. workers defaults to, and is capped at, the number of CPUs."},
+	{"parse_parallel",(PyCFunction)multipart_parse_parallel,METH_VARARGS|METH_KEYWORDS,"parse_parallel(boundary, body, workers=0)\n\nParses one body that is already in memory, searching segments of it for\ndelimiters on a pool of native threads. Returns a list of (headers, data)\ntuples, where data is a read-only buffer into body."},
 	{NULL,NULL,0,NULL}
 };
 
@@ -27,9 +33,7 @@ initmultipart(void)
 {
     
 
-    multipart_GeneratorType.tp_new = &PyType_GenericNew;
-    
-    if (PyType_Ready(&multipart_ParserType) < 0 or PyType_Ready(&multipart_GeneratorType) < 0)
+    if (PyType_Ready(&multipart_ParserType) < 0 or PyType_Ready(&multipart_GeneratorType) < 0 or PyType_Ready(&multipart_HeadersType) < 0 or PyType_Ready(&multipart_PartType) < 0 or PyType_Ready(&multipart_PushParserType) < 0 or PyType_Ready(&multipart_EncoderType) < 0)
     {
         return;
     }
@@ -41,4 +45,26 @@ initmultipart(void)
     
     PyModule_AddObject(multipartModule, "Parser", (PyObject *)&multipart_ParserType);
     PyModule_AddObject(multipartModule, "Generator", (PyObject *)&multipart_GeneratorType);
+    Py_INCREF(&multipart_HeadersType);
+    PyModule_AddObject(multipartModule, "Headers", (PyObject *)&multipart_HeadersType);
+    Py_INCREF(&multipart_PartType);
+    PyModule_AddObject(multipartModule, "Part", (PyObject *)&multipart_PartType);
+
+    Py_INCREF(&multipart_PushParserType);
+    PyModule_AddObject(multipartModule, "PushParser", (PyObject *)&multipart_PushParserType);
+    Py_INCREF(&multipart_EncoderType);
+    PyModule_AddObject(multipartModule, "Encoder", (PyObject *)&multipart_EncoderType);
+    PyModule_AddIntConstant(multipartModule, "PART_BEGIN", multipart_PushParser_PART_BEGIN);
+    PyModule_AddIntConstant(multipartModule, "HEADER", multipart_PushParser_HEADER);
+    PyModule_AddIntConstant(multipartModule, "DATA", multipart_PushParser_DATA);
+    PyModule_AddIntConstant(multipartModule, "DATA_BYTES", multipart_PushParser_DATA_BYTES);
+    PyModule_AddIntConstant(multipartModule, "PART_END", multipart_PushParser_PART_END);
+    PyModule_AddIntConstant(multipartModule, "BODY_END", multipart_PushParser_BODY_END);
+
+    multipart_LimitError = PyErr_NewException("multipart.LimitError", PyExc_ValueError, NULL);
+    if (multipart_LimitError)
+    {
+        Py_INCREF(multipart_LimitError);
+        PyModule_AddObject(multipartModule, "LimitError", multipart_LimitError);
+    }
 }
@@ -0,0 +1,936 @@
+#include <Python.h>
+#include <structmember.h>
+
+#include "multipart_Encoder.h"
+#include "iso646.h"
+#include "stdbool.h"
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+//One piece of the encoded body: either a string sent as it is, or the
+//rest of a file
+typedef struct
+{
+	//The string, or the file object that owns fd
+	PyObject * data;
+	//-1 for a string
+	int fd;
+	//Where the content starts in the file, or -1 if it cannot seek
+	off_t offset;
+	//Bytes of the file to send, or -1 to send everything up to its end
+	Py_ssize_t length;
+}encoderPiece;
+
+typedef struct
+{
+	PyObject_HEAD
+	PyObject * boundary;
+	//Set when the caller chose the boundary, so the content has to be
+	//checked for it. A generated one is trusted not to turn up.
+	bool chosenBoundary;
+	PyObject * contentType;
+	//The exact length of the body, or -1 if a file's size is unknown
+	Py_ssize_t contentLength;
+	//Size of the chunks of file content, and the most bytes of strings
+	//that are gathered into one chunk
+	size_t chunkSize;
+	
+	encoderPiece * pieces;
+	size_t pieceCount;
+	size_t pieceSize;
+	
+	//Bytes gathered for the next string piece
+	char * literal;
+	size_t literalLength;
+	size_t literalSize;
+	
+	//The piece iteration is at, and the bytes of it already returned
+	size_t piece;
+	off_t pieceDone;
+}multipart_Encoder;
+
+static PyObject* Encoder_new(PyTypeObject * type, PyObject * args, PyObject * kwds)
+{
+	multipart_Encoder * self = (multipart_Encoder*)type->tp_alloc(type,0);
+	
+	if(self!=NULL)
+	{
+		self->boundary = NULL;
+		self->chosenBoundary = false;
+		self->contentType = NULL;
+		self->contentLength = 0;
+		self->chunkSize = 0;
+		
+		self->pieces = NULL;
+		self->pieceCount = 0;
+		self->pieceSize = 0;
+		
+		self->literal = NULL;
+		self->literalLength = 0;
+		self->literalSize = 0;
+		
+		self->piece = 0;
+		self->pieceDone = 0;
+	}
+	
+	return (PyObject*)self;
+}
+
+static void Encoder_dealloc(multipart_Encoder * self)
+{
+	for(size_t i = 0; i < self->pieceCount; i++)
+	{
+		Py_DECREF(self->pieces[i].data);
+	}
+	
+	PyMem_Free(self->pieces);
+	PyMem_Free(self->literal);
+	Py_XDECREF(self->boundary);
+	Py_XDECREF(self->contentType);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+//Appends a piece, stealing the reference to data
+static bool addPiece(multipart_Encoder * const self, PyObject * const data, int const fd, off_t const offset, Py_ssize_t const length)
+{
+	if(self->pieceCount == self->pieceSize)
+	{
+		const size_t newSize = self->pieceSize ? self->pieceSize * 2 : 8;
+		encoderPiece * const replacement = PyMem_Realloc(self->pieces,newSize * sizeof(encoderPiece));
+		
+		if(not replacement)
+		{
+			Py_DECREF(data);
+			PyErr_NoMemory();
+			return false;
+		}
+		self->pieces = replacement;
+		self->pieceSize = newSize;
+	}
+	
+	encoderPiece * const piece = &self->pieces[self->pieceCount];
+	piece->data = data;
+	piece->fd = fd;
+	piece->offset = offset;
+	piece->length = length;
+	self->pieceCount += 1;
+	
+	if(self->contentLength != -1)
+	{
+		self->contentLength = length == -1 ? -1 : self->contentLength + length;
+	}
+	return true;
+}
+
+//Turns the gathered bytes into a string piece
+static bool flushLiteral(multipart_Encoder * const self)
+{
+	if(self->literalLength == 0)
+	{
+		return true;
+	}
+	
+	PyObject * const string = PyString_FromStringAndSize(self->literal,self->literalLength);
+	self->literalLength = 0;
+	
+	return string and addPiece(self,string,-1,0,PyString_GET_SIZE(string));
+}
+
+static bool appendLiteral(multipart_Encoder * const self, const char * const data, size_t const length)
+{
+	const size_t requiredSize = self->literalLength + length;
+	
+	if(requiredSize > self->literalSize)
+	{
+		const size_t newSize = requiredSize < 4096 ? 4096 : requiredSize * 2;
+		char * const newMem = PyMem_Realloc(self->literal,newSize);
+		
+		if(not newMem)
+		{
+			PyErr_NoMemory();
+			return false;
+		}
+		self->literal = newMem;
+		self->literalSize = newSize;
+	}
+	
+	memcpy(self->literal + self->literalLength,data,length);
+	self->literalLength += length;
+	
+	//Small parts share a chunk, but no chunk grows much past chunkSize
+	return self->literalLength < self->chunkSize or flushLiteral(self);
+}
+
+static bool appendString(multipart_Encoder * const self, const char * const string)
+{
+	return appendLiteral(self,string,strlen(string));
+}
+
+//Raises ValueError if data holds the boundary after "--", which could
+//end the part early. Files are not read up front, so their content is
+//left to the caller.
+static bool checkContent(multipart_Encoder * const self, const char * const data, size_t const length)
+{
+	if(not self->chosenBoundary)
+	{
+		return true;
+	}
+	
+	const char * const boundary = PyString_AS_STRING(self->boundary);
+	const size_t boundaryLength = PyString_GET_SIZE(self->boundary);
+	const char * const end = data + length;
+	const char * at = data;
+	
+	while((at = memmem(at,end - at,boundary,boundaryLength)))
+	{
+		if(at - data >= 2 and at[-1] == '-' and at[-2] == '-')
+		{
+			PyErr_SetString(PyExc_ValueError,"part content contains the boundary");
+			return false;
+		}
+		at += 1;
+	}
+	
+	return true;
+}
+
+//Appends "name: value\r\n", refusing line breaks that would let a value
+//start a header or part of its own
+static bool appendHeader(multipart_Encoder * const self, PyObject * const header)
+{
+	if(not PyTuple_Check(header) or PyTuple_GET_SIZE(header) != 2)
+	{
+		PyErr_SetString(PyExc_TypeError,"headers must be (name, value) tuples");
+		return false;
+	}
+	
+	char * name;
+	char * value;
+	Py_ssize_t nameLength;
+	Py_ssize_t valueLength;
+	
+	if(PyString_AsStringAndSize(PyTuple_GET_ITEM(header,0),&name,&nameLength) == -1 or
+	   PyString_AsStringAndSize(PyTuple_GET_ITEM(header,1),&value,&valueLength) == -1)
+	{
+		return false;
+	}
+	
+	if(memchr(name,'\r',nameLength) or memchr(name,'\n',nameLength) or memchr(name,':',nameLength) or
+	   memchr(value,'\r',valueLength) or memchr(value,'\n',valueLength))
+	{
+		PyErr_Format(PyExc_ValueError,"header %s contains a line break or colon",name);
+		return false;
+	}
+	
+	if(not checkContent(self,value,valueLength))
+	{
+		return false;
+	}
+	
+	return appendLiteral(self,name,nameLength) and appendLiteral(self,": ",2) and
+	       appendLiteral(self,value,valueLength) and appendLiteral(self,"\r\n",2);
+}
+
+static bool appendHeaders(multipart_Encoder * const self, PyObject * headers)
+{
+	//A dict, such as multipart.Headers, gives its items in no set order
+	if(PyDict_Check(headers))
+	{
+		headers = PyDict_Items(headers);
+	}
+	else
+	{
+		Py_INCREF(headers);
+	}
+	
+	PyObject * const sequence = headers ? PySequence_Fast(headers,"headers must be a list of (name, value) tuples or a dict") : NULL;
+	Py_XDECREF(headers);
+	
+	if(not sequence)
+	{
+		return false;
+	}
+	
+	bool ok = true;
+	for(Py_ssize_t i = 0; ok and i < PySequence_Fast_GET_SIZE(sequence); i++)
+	{
+		ok = appendHeader(self,PySequence_Fast_GET_ITEM(sequence,i));
+	}
+	
+	Py_DECREF(sequence);
+	return ok;
+}
+
+//Where the content of a file object starts. Its tell() is asked first,
+//since a buffered file may have read ahead of it on the descriptor.
+static off_t filePosition(PyObject * const file, int const fd)
+{
+	PyObject * const position = PyObject_HasAttrString(file,"tell") ? PyObject_CallMethod(file,"tell",NULL) : NULL;
+	
+	if(not position)
+	{
+		PyErr_Clear();
+		return lseek(fd,0,SEEK_CUR);
+	}
+	
+	const off_t offset = PyInt_AsSsize_t(position);
+	Py_DECREF(position);
+	
+	if(offset < 0)
+	{
+		PyErr_Clear();
+		return -1;
+	}
+	return offset;
+}
+
+//Adds the rest of an open file. A regular file that can seek has a known
+//length and is read with pread, leaving its position alone.
+static bool appendFile(multipart_Encoder * const self, PyObject * const file, int const fd)
+{
+	if(not flushLiteral(self))
+	{
+		return false;
+	}
+	
+	//Whatever the file object still buffers has to reach the descriptor
+	if(PyObject_HasAttrString(file,"flush"))
+	{
+		PyObject * const result = PyObject_CallMethod(file,"flush",NULL);
+		
+		if(not result)
+		{
+			return false;
+		}
+		Py_DECREF(result);
+	}
+	
+	struct stat info;
+	off_t offset = filePosition(file,fd);
+	Py_ssize_t length = -1;
+	
+	if(offset != -1 and fstat(fd,&info) == 0 and S_ISREG(info.st_mode))
+	{
+		length = info.st_size > offset ? info.st_size - offset : 0;
+	}
+	else
+	{
+		offset = -1;
+	}
+	
+	Py_INCREF(file);
+	return addPiece(self,file,fd,offset,length);
+}
+
+static bool appendBody(multipart_Encoder * const self, PyObject * const body)
+{
+	//Large strings are sent as they are, small ones join the chunk
+	if(PyString_Check(body))
+	{
+		if(not checkContent(self,PyString_AS_STRING(body),PyString_GET_SIZE(body)))
+		{
+			return false;
+		}
+		
+		if((size_t)PyString_GET_SIZE(body) < self->chunkSize)
+		{
+			return appendLiteral(self,PyString_AS_STRING(body),PyString_GET_SIZE(body));
+		}
+		
+		if(not flushLiteral(self))
+		{
+			return false;
+		}
+		Py_INCREF(body);
+		return addPiece(self,body,-1,0,PyString_GET_SIZE(body));
+	}
+	
+	if(PyUnicode_Check(body))
+	{
+		PyErr_SetString(PyExc_TypeError,"part bodies must be bytes, not unicode");
+		return false;
+	}
+	
+	if(PyObject_HasAttrString(body,"fileno"))
+	{
+		const int fd = PyObject_AsFileDescriptor(body);
+		
+		if(fd != -1)
+		{
+			return appendFile(self,body,fd);
+		}
+		PyErr_Clear();
+	}
+	
+	//A file-like object without a descriptor is read in one go
+	if(PyObject_HasAttrString(body,"read"))
+	{
+		PyObject * const content = PyObject_CallMethod(body,"read",NULL);
+		
+		if(not content)
+		{
+			return false;
+		}
+		if(not PyString_Check(content))
+		{
+			Py_DECREF(content);
+			PyErr_SetString(PyExc_TypeError,"read() of a part body must return bytes");
+			return false;
+		}
+		
+		const bool ok = appendBody(self,content);
+		Py_DECREF(content);
+		return ok;
+	}
+	
+	const void * data;
+	Py_ssize_t length;
+	
+	if(PyObject_AsReadBuffer(body,&data,&length) == -1)
+	{
+		PyErr_SetString(PyExc_TypeError,"part bodies must be strings, buffers or files");
+		return false;
+	}
+	
+	PyObject * const copy = PyString_FromStringAndSize(data,length);
+	if(not copy)
+	{
+		return false;
+	}
+	
+	const bool ok = appendBody(self,copy);
+	Py_DECREF(copy);
+	return ok;
+}
+
+//A boundary of random hex digits, which no part is going to contain
+static PyObject * randomBoundary(void)
+{
+	unsigned char random[16];
+	
+	if(_PyOS_URandom(random,sizeof(random)) == -1)
+	{
+		return NULL;
+	}
+	
+	static const char DIGITS[] = "0123456789abcdef";
+	char boundary[16 + sizeof(random) * 2];
+	memset(boundary,'-',16);
+	
+	for(size_t i = 0; i < sizeof(random); i++)
+	{
+		boundary[16 + i*2] = DIGITS[random[i] >> 4];
+		boundary[16 + i*2 + 1] = DIGITS[random[i] & 0xf];
+	}
+	
+	return PyString_FromStringAndSize(boundary,sizeof(boundary));
+}
+
+//Besides letters and digits, RFC 2046 allows these in a boundary. The
+//second set has to be quoted in the Content-Type header.
+static const char BOUNDARY_CHARS[] = "'+_-.";
+static const char QUOTED_BOUNDARY_CHARS[] = "(),/:=? ";
+
+//Returns 1 if boundary can be used as it is, 2 if it can once quoted and
+//0 if it cannot be used at all
+static int checkBoundary(const char * const boundary, Py_ssize_t const length)
+{
+	int result = 1;
+	
+	if(length < 1 or length > 70 or boundary[length-1] == ' ')
+	{
+		return 0;
+	}
+	
+	for(Py_ssize_t i = 0; i < length; i++)
+	{
+		const char c = boundary[i];
+		
+		if((c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or (c >= '0' and c <= '9') or
+		   (c and strchr(BOUNDARY_CHARS,c)))
+		{
+			continue;
+		}
+		
+		if(not c or not strchr(QUOTED_BOUNDARY_CHARS,c))
+		{
+			return 0;
+		}
+		result = 2;
+	}
+	
+	return result;
+}
+
+static int Encoder_init(multipart_Encoder * const self, PyObject * args, PyObject * kwds)
+{
+	PyObject * parts;
+	PyObject * boundary = Py_None;
+	Py_ssize_t chunkSize = 256*1024;
+	static char * kwlist[] = {"parts","boundary","chunk_size",NULL};
+	if( not PyArg_ParseTupleAndKeywords(args,kwds,"O|On",kwlist,&parts,&boundary,&chunkSize) )
+	{
+		return -1;
+	}
+	
+	//The pieces are built up as the parts are read, so a second call
+	//would add to them
+	if(self->boundary)
+	{
+		PyErr_SetString(PyExc_RuntimeError,"Encoder cannot be initialised twice");
+		return -1;
+	}
+	
+	if(chunkSize <= 0)
+	{
+		PyErr_SetString(PyExc_ValueError,"chunk_size must be positive");
+		return -1;
+	}
+	self->chunkSize = chunkSize;
+	
+	//The boundary goes into the Content-Type header and every delimiter
+	//line unescaped
+	int usable = 1;
+	if(boundary == Py_None)
+	{
+		self->boundary = randomBoundary();
+	}
+	else if(PyString_Check(boundary) and (usable = checkBoundary(PyString_AS_STRING(boundary),PyString_GET_SIZE(boundary))))
+	{
+		self->boundary = boundary;
+		self->chosenBoundary = true;
+		Py_INCREF(boundary);
+	}
+	else
+	{
+		PyErr_SetString(PyExc_ValueError,"boundary must be 1 to 70 of the characters RFC 2046 allows, not ending in a space");
+		return -1;
+	}
+	
+	if(not self->boundary)
+	{
+		return -1;
+	}
+	
+	self->contentType = PyString_FromFormat(usable == 2 ? "multipart/form-data; boundary=\"%s\"" : "multipart/form-data; boundary=%s",PyString_AS_STRING(self->boundary));
+	if(not self->contentType)
+	{
+		return -1;
+	}
+	
+	PyObject * const iterator = PyObject_GetIter(parts);
+	if(not iterator)
+	{
+		return -1;
+	}
+	
+	const char * const delimiter = PyString_AS_STRING(self->boundary);
+	PyObject * part;
+	bool ok = true;
+	
+	while(ok and (part = PyIter_Next(iterator)))
+	{
+		if(not PyTuple_Check(part) or PyTuple_GET_SIZE(part) != 2)
+		{
+			PyErr_SetString(PyExc_TypeError,"parts must be (headers, body) tuples");
+			ok = false;
+		}
+		
+		ok = ok and appendString(self,"--") and appendString(self,delimiter) and appendString(self,"\r\n") and
+		     appendHeaders(self,PyTuple_GET_ITEM(part,0)) and appendString(self,"\r\n") and
+		     appendBody(self,PyTuple_GET_ITEM(part,1)) and appendString(self,"\r\n");
+		Py_DECREF(part);
+	}
+	Py_DECREF(iterator);
+	
+	if(not ok or PyErr_Occurred())
+	{
+		return -1;
+	}
+	
+	if(not appendString(self,"--") or not appendString(self,delimiter) or not appendString(self,"--\r\n") or not flushLiteral(self))
+	{
+		return -1;
+	}
+	
+	return 0;
+}
+
+static PyObject * Encoder_iter(PyObject * const self)
+{
+	Py_INCREF(self);
+	return self;
+}
+
+//Reads up to length bytes of a file piece from where done leaves off
+static ssize_t readPiece(const encoderPiece * const piece, char * const buffer, size_t const length, off_t const done)
+{
+	ssize_t result;
+	
+	do
+	{
+		Py_BEGIN_ALLOW_THREADS
+		result = piece->offset == -1 ? read(piece->fd,buffer,length) : pread(piece->fd,buffer,length,piece->offset + done);
+		Py_END_ALLOW_THREADS
+	}while(result < 0 and errno == EINTR);
+	
+	if(result < 0)
+	{
+		PyErr_SetFromErrno(PyExc_IOError);
+	}
+	//The length was promised in content_length
+	else if(result == 0 and piece->length != -1 and done < piece->length)
+	{
+		PyErr_SetString(PyExc_IOError,"file is shorter than when the encoder was created");
+		result = -1;
+	}
+	
+	return result;
+}
+
+static PyObject * Encoder_iternext(multipart_Encoder * const self)
+{
+	while(self->piece < self->pieceCount)
+	{
+		const encoderPiece * const piece = &self->pieces[self->piece];
+		
+		if(piece->fd == -1)
+		{
+			self->piece += 1;
+			Py_INCREF(piece->data);
+			return piece->data;
+		}
+		
+		size_t length = self->chunkSize;
+		if(piece->length != -1 and (off_t)length > piece->length - self->pieceDone)
+		{
+			length = piece->length - self->pieceDone;
+		}
+		
+		if(length == 0)
+		{
+			self->piece += 1;
+			self->pieceDone = 0;
+			continue;
+		}
+		
+		PyObject * chunk = PyString_FromStringAndSize(NULL,length);
+		if(not chunk)
+		{
+			return NULL;
+		}
+		
+		const ssize_t result = readPiece(piece,PyString_AS_STRING(chunk),length,self->pieceDone);
+		
+		if(result <= 0)
+		{
+			Py_DECREF(chunk);
+			if(result < 0)
+			{
+				return NULL;
+			}
+			self->piece += 1;
+			self->pieceDone = 0;
+			continue;
+		}
+		
+		self->pieceDone += result;
+		
+		if((size_t)result < length and _PyString_Resize(&chunk,result) == -1)
+		{
+			return NULL;
+		}
+		return chunk;
+	}
+	
+	return NULL;
+}
+
+//Writes the buffers out completely with the GIL released
+static bool writeAll(int const fd, struct iovec * iov, int count, size_t * const written)
+{
+	while(count > 0)
+	{
+		ssize_t result;
+		Py_BEGIN_ALLOW_THREADS
+		result = writev(fd,iov,count);
+		Py_END_ALLOW_THREADS
+		
+		if(result < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			PyErr_SetFromErrno(PyExc_IOError);
+			return false;
+		}
+		*written += result;
+		
+		//Skip whatever was written, which may end inside a buffer
+		while(count > 0 and (size_t)result >= iov->iov_len)
+		{
+			result -= iov->iov_len;
+			iov += 1;
+			count -= 1;
+		}
+		if(count > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + result;
+			iov->iov_len -= result;
+		}
+	}
+	
+	return true;
+}
+
+//Copies a file piece to fd inside the kernel where it can: with
+//copy_file_range into a regular file, otherwise with sendfile. Returns
+//the bytes copied, or -1 with errno set if neither applies to these
+//descriptors.
+static ssize_t copyInKernel(const encoderPiece * const piece, int const fd, bool const regular, off_t * const offset, size_t const length)
+{
+#ifdef __linux__
+	ssize_t result = -1;
+	errno = ENOSYS;
+	
+#ifdef SYS_copy_file_range
+	if(regular)
+	{
+		loff_t from = *offset;
+		result = syscall(SYS_copy_file_range,piece->fd,&from,fd,NULL,length,0);
+		if(result >= 0)
+		{
+			*offset = from;
+			return result;
+		}
+		if(errno != EXDEV and errno != EINVAL and errno != ENOSYS and errno != EOPNOTSUPP)
+		{
+			return -1;
+		}
+	}
+#endif
+	
+	result = sendfile(fd,piece->fd,offset,length);
+	return result;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+//Writes a file piece to fd from start on, in the kernel if possible and
+//through a buffer otherwise
+static bool writeFile(const encoderPiece * const piece, off_t const start, int const fd, bool const regular, size_t * const written)
+{
+	off_t offset = piece->offset == -1 ? -1 : piece->offset + start;
+	off_t done = start;
+	bool inKernel = piece->offset != -1;
+	char * buffer = NULL;
+	bool ok = true;
+	
+	while(piece->length == -1 or done < piece->length)
+	{
+		const size_t length = piece->length == -1 ? 1 << 20 : (size_t)(piece->length - done);
+		ssize_t result = -1;
+		
+		if(inKernel)
+		{
+			Py_BEGIN_ALLOW_THREADS
+			result = copyInKernel(piece,fd,regular,&offset,length);
+			Py_END_ALLOW_THREADS
+			
+			if(result < 0 and errno == EINTR)
+			{
+				continue;
+			}
+			if(result < 0 and (errno == EINVAL or errno == ENOSYS))
+			{
+				inKernel = false;
+				continue;
+			}
+			if(result < 0)
+			{
+				PyErr_SetFromErrno(PyExc_IOError);
+				ok = false;
+				break;
+			}
+		}
+		else
+		{
+			static const size_t BUFFER_SIZE = 256*1024;
+			if(not buffer and not (buffer = PyMem_Malloc(BUFFER_SIZE)))
+			{
+				PyErr_NoMemory();
+				ok = false;
+				break;
+			}
+			
+			result = readPiece(piece,buffer,length < BUFFER_SIZE ? length : BUFFER_SIZE,done);
+			if(result < 0)
+			{
+				ok = false;
+				break;
+			}
+			
+			struct iovec iov = { buffer, (size_t)result };
+			if(result > 0 and not writeAll(fd,&iov,1,written))
+			{
+				ok = false;
+				break;
+			}
+			done += result;
+			if(result == 0)
+			{
+				break;
+			}
+			continue;
+		}
+		
+		if(result == 0)
+		{
+			if(piece->length != -1)
+			{
+				PyErr_SetString(PyExc_IOError,"file is shorter than when the encoder was created");
+				ok = false;
+			}
+			break;
+		}
+		done += result;
+		*written += result;
+	}
+	
+	PyMem_Free(buffer);
+	return ok;
+}
+
+static PyObject * Encoder_writeTo(multipart_Encoder * const self, PyObject * const target)
+{
+	const int fd = PyObject_AsFileDescriptor(target);
+	
+	if(fd == -1)
+	{
+		return NULL;
+	}
+	
+	struct stat info;
+	const bool regular = fstat(fd,&info) == 0 and S_ISREG(info.st_mode);
+	size_t written = 0;
+	
+	//Whatever iteration already returned is not sent again, since a file
+	//that cannot seek has been read past it. The body is used up either
+	//way, even if writing fails.
+	const size_t first = self->piece;
+	const off_t firstDone = self->pieceDone;
+	self->piece = self->pieceCount;
+	self->pieceDone = 0;
+	
+	//Runs of strings go out in one writev each
+	struct iovec iov[64];
+	int count = 0;
+	
+	for(size_t i = first; i < self->pieceCount; i++)
+	{
+		const encoderPiece * const piece = &self->pieces[i];
+		
+		if(piece->fd != -1)
+		{
+			if(not writeFile(piece,i == first ? firstDone : 0,fd,regular,&written))
+			{
+				return NULL;
+			}
+			continue;
+		}
+		
+		iov[count].iov_base = PyString_AS_STRING(piece->data);
+		iov[count].iov_len = PyString_GET_SIZE(piece->data);
+		count += 1;
+		
+		const bool more = i + 1 < self->pieceCount and self->pieces[i + 1].fd == -1;
+		if(more and count < (int)(sizeof(iov)/sizeof(iov[0])))
+		{
+			continue;
+		}
+		
+		if(not writeAll(fd,iov,count,&written))
+		{
+			return NULL;
+		}
+		count = 0;
+	}
+	
+	return PyLong_FromSize_t(written);
+}
+
+static PyObject * Encoder_getContentLength(multipart_Encoder * const self, void * const closure)
+{
+	if(self->contentLength == -1)
+	{
+		Py_RETURN_NONE;
+	}
+	return PyInt_FromSsize_t(self->contentLength);
+}
+
+static PyMethodDef Encoder_methods[] = {
+	{"write_to",(PyCFunction)Encoder_writeTo, METH_O, "write_to(fd)\n\nWrites the body to a file descriptor or an object with fileno(), copying\nfile parts inside the kernel where possible. After a partial iteration,\nonly the rest of the body is written. Returns the number of bytes written."},
+	{NULL,NULL,0,NULL}
+};
+static PyMemberDef Encoder_members[] = {
+	{"boundary",T_OBJECT,offsetof(multipart_Encoder,boundary),READONLY,"the boundary between parts, without the leading --"},
+	{"content_type",T_OBJECT,offsetof(multipart_Encoder,contentType),READONLY,"the Content-Type header value for the body"},
+	{NULL}
+};
+static PyGetSetDef Encoder_getset[] = {
+	{"content_length",(getter)Encoder_getContentLength,NULL,"the exact length of the body, or None if a file part has no known size",NULL},
+	{NULL}
+};
+
+PyTypeObject multipart_EncoderType = {
+	PyObject_HEAD_INIT(NULL)
+	0,                         /*ob_size*/
+    "multipart.Encoder",             /*tp_name*/
+    sizeof(multipart_Encoder), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)Encoder_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_HAVE_CLASS | Py_TPFLAGS_HAVE_ITER,        /*tp_flags*/
+    "Encoder objects, iterating over the chunks of a multipart body",           /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    Encoder_iter,		               /* tp_iter */
+    (iternextfunc)Encoder_iternext,              /* tp_iternext */
+    Encoder_methods,             /* tp_methods */
+    Encoder_members,             /* tp_members */
+    Encoder_getset,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)Encoder_init,      /* tp_init */
+    0,                         /* tp_alloc */
+    Encoder_new                 /* tp_new */
+	
+};
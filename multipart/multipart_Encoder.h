@@ -0,0 +1,9 @@
+#include <Python.h>
+#include <structmember.h>
+
+#ifndef __multipart_Encoder
+#define __multipart_Encoder
+
+extern PyTypeObject multipart_EncoderType;
+
+#endif
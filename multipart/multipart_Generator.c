@@ -1,93 +1,430 @@
 #include "multipart_Generator.h"
 #include "stdbool.h"
 #include "iso646.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 typedef struct
 {
 	PyObject_HEAD
 	PyObject * callback;
 	
+	//Set for generators created by multipart_Generator_new, which
+	//call pull(owner) instead of callback
+	PyObject * owner;
+	multipart_Generator_pull pull;
+	
 	PyObject ** queue;
 	size_t queueSize;
 	size_t queueLength;
 	size_t queueRead;
 	
 	bool done;
+	
+	//Total of queued data bytes shared with the owner, or NULL
+	size_t * account;
+	//Data bytes in this generator's own queue
+	size_t queuedBytes;
+	
+	//Once more than spoolThreshold bytes would be queued, further data
+	//goes to the unlinked file spoolFd until it has all been read back
+	size_t spoolThreshold;
+	PyObject * spoolDir;
+	int spoolFd;
+	off_t spoolRead;
+	off_t spoolWrite;
+	
+	//Digests of the data, set by the owner once it has all been pushed
+	PyObject * digests;
 }multipart_Generator;
 
+//Size of the chunks read back from the temporary file
+static const size_t SPOOL_CHUNK = 256*1024;
+
+//Length of a queued data item for accounting. Other items count as zero.
+static size_t itemSize(PyObject * const item)
+{
+	if(PyString_Check(item))
+	{
+		return PyString_GET_SIZE(item);
+	}
+	
+	if(PyBuffer_Check(item))
+	{
+		const Py_ssize_t length = PyObject_Size(item);
+		if(length < 0)
+		{
+			PyErr_Clear();
+			return 0;
+		}
+		return length;
+	}
+	
+	return 0;
+}
+
 static PyObject * Generator_iter(PyObject * const self)
 {
 	Py_INCREF(self);
 	return self;
 }
 
-static PyObject * Generator_iternext(multipart_Generator * const self)
+//Reads the next chunk of spooled data back from the temporary file
+static PyObject * readSpool(multipart_Generator * const self)
 {
-	PyObject * const emptyTuple = PyTuple_New(0);
+	off_t available = self->spoolWrite - self->spoolRead;
+	const size_t length = available < (off_t)SPOOL_CHUNK ? (size_t)available : SPOOL_CHUNK;
+	
+	PyObject * const bytes = PyString_FromStringAndSize(NULL,(Py_ssize_t)length);
+	
+	if(not bytes)
+	{
+		return NULL;
+	}
+	
+	char * const buffer = PyString_AS_STRING(bytes);
+	size_t done = 0;
+	
+	while(done < length)
+	{
+		ssize_t result;
+		Py_BEGIN_ALLOW_THREADS
+		result = pread(self->spoolFd,buffer + done,length - done,self->spoolRead + done);
+		Py_END_ALLOW_THREADS
+		
+		if(result < 0 and errno == EINTR)
+		{
+			continue;
+		}
+		
+		if(result <= 0)
+		{
+			Py_DECREF(bytes);
+			if(result == 0)
+			{
+				PyErr_SetString(PyExc_IOError,"spool file is shorter than the data written to it");
+				return NULL;
+			}
+			return PyErr_SetFromErrno(PyExc_IOError);
+		}
+		done += result;
+	}
+	
+	self->spoolRead += length;
+	
+	//Once everything has been read back, the file is reused from the start
+	if(self->spoolRead == self->spoolWrite)
+	{
+		self->spoolRead = 0;
+		self->spoolWrite = 0;
+	}
 	
+	return bytes;
+}
+
+static PyObject * Generator_iternext(multipart_Generator * const self)
+{
 	while(self->queueRead == self->queueLength)
 	{
+		//Spooled data is always newer than the queued items
+		if(self->spoolRead < self->spoolWrite)
+		{
+			return readSpool(self);
+		}
+		
 		if(self->done)
 		{
-			Py_DECREF(emptyTuple);
 			return NULL;
 		}
 		
-		PyObject * const result = PyObject_Call(self->callback,emptyTuple,NULL);
+		if(self->pull)
+		{
+			if(not self->pull(self->owner))
+			{
+				return NULL;
+			}
+			continue;
+		}
+		
+		PyObject * const result = PyObject_CallObject(self->callback,NULL);
 		
 		if(not result)
 		{
-			Py_DECREF(emptyTuple);
 			return NULL;
 		}
 		
 		Py_DECREF(result);
 		
 	}
-	Py_DECREF(emptyTuple);
 	
 	PyObject * const retval = self->queue[self->queueRead];
 	self->queue[self->queueRead] = NULL;
 	self->queueRead += 1;
 	
+	const size_t size = itemSize(retval);
+	self->queuedBytes -= size;
+	if(self->account)
+	{
+		*self->account -= size;
+	}
+	
 	return retval;
 
 }
 
+//Puts every field but the queue memory into its starting state
+static void resetGenerator(multipart_Generator * const self)
+{
+	self->callback = NULL;
+	self->owner = NULL;
+	self->pull = NULL;
+	
+	self->queueLength = 0;
+	self->queueRead = 0;
+	self->done = false;
+	self->account = NULL;
+	self->queuedBytes = 0;
+	
+	self->spoolThreshold = 0;
+	self->spoolDir = NULL;
+	self->spoolFd = -1;
+	self->spoolRead = 0;
+	self->spoolWrite = 0;
+	
+	self->digests = NULL;
+}
+
 static PyObject* Generator_new(PyTypeObject * type, PyObject * args, PyObject * kwds)
 {
 	multipart_Generator * self = (multipart_Generator*)type->tp_alloc(type,0);
 	
 	if(self!=NULL)
 	{
-		self->callback = NULL;
-		
-		self->queueLength = 0;
-		self->queueRead = 0;
-		self->done = false;
+		resetGenerator(self);
 		self->queue = NULL;
-		
 	}
 	
 	return (PyObject*)self;
 }
 
-static void Generator_dealloc(multipart_Generator * self)
+//Drops everything the generator refers to, keeping its queue memory
+static void releaseGenerator(multipart_Generator * const self)
 {
 	for(size_t i = self->queueRead; i < self->queueLength; ++i)
 	{
+		if(self->account)
+		{
+			*self->account -= itemSize(self->queue[i]);
+		}
 		Py_DECREF(self->queue[i]);
 	}
 	
-	PyMem_Free(self->queue);
 	Py_XDECREF(self->callback);
+	Py_XDECREF(self->owner);
+	Py_XDECREF(self->spoolDir);
+	Py_XDECREF(self->digests);
+	
+	if(self->spoolFd != -1)
+	{
+		close(self->spoolFd);
+	}
+}
+
+//Generators created natively are kept here once dropped, together with
+//their queues, and handed out again by the next multipart_Generator_new
+//or multipart_Part_new call instead of allocating new ones
+typedef struct
+{
+	multipart_Generator * items[64];
+	int length;
+}freeList;
+
+static freeList generatorFreeList;
+static freeList partFreeList;
+
+//A queue that grew beyond this is given back rather than recycled
+static const size_t MAX_RECYCLED_QUEUE = 64;
+
+static bool recycle(freeList * const list, multipart_Generator * const self)
+{
+	if(not self->pull or self->queueSize > MAX_RECYCLED_QUEUE or
+	   list->length == (int)(sizeof(list->items)/sizeof(list->items[0])))
+	{
+		return false;
+	}
+	
+	list->items[list->length] = self;
+	list->length += 1;
+	return true;
+}
+
+static multipart_Generator * reuse(freeList * const list, PyTypeObject * const type)
+{
+	if(list->length == 0)
+	{
+		return NULL;
+	}
+	
+	list->length -= 1;
+	multipart_Generator * const self = list->items[list->length];
+	PyObject_INIT(self,type);
+	resetGenerator(self);
+	return self;
+}
+
+static void Generator_dealloc(multipart_Generator * self)
+{
+	releaseGenerator(self);
+	
+	if(Py_TYPE(self) == &multipart_GeneratorType and recycle(&generatorFreeList,self))
+	{
+		return;
+	}
+	
+	PyMem_Free(self->queue);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static bool allocateQueue(multipart_Generator * self)
+{
+	static const int STARTING_SIZE = 4;
+	const int SIZE_BYTES = sizeof(PyObject*)*STARTING_SIZE;
+
+	self->queueSize = STARTING_SIZE;
+
+	self->queue = PyMem_Malloc(SIZE_BYTES);
+	if(not self->queue)
+	{
+		PyErr_NoMemory();
+		return false;
+	}
+	bzero(self->queue,SIZE_BYTES);
+	
+	return true;
 }
+
 static PyObject * Generator_done(multipart_Generator * self, PyObject *args, PyObject *kwds)
 {
 	self->done = true;
 	Py_RETURN_NONE;
 }
 
+void multipart_Generator_done(PyObject * self)
+{
+	((multipart_Generator*)self)->done = true;
+}
+
+void multipart_Generator_setDigests(PyObject * const self, PyObject * const digests)
+{
+	Py_INCREF(digests);
+	Py_XSETREF(((multipart_Generator*)self)->digests,digests);
+}
+
+void multipart_Generator_account(PyObject * self, size_t * account)
+{
+	((multipart_Generator*)self)->account = account;
+}
+
+void multipart_Generator_spoolAfter(PyObject * const generator, size_t threshold, PyObject * dir)
+{
+	multipart_Generator * const self = (multipart_Generator*)generator;
+	
+	self->spoolThreshold = threshold;
+	Py_XINCREF(dir);
+	Py_XSETREF(self->spoolDir,dir);
+}
+
+//Creates the temporary file and unlinks it right away, so it goes away
+//with the descriptor
+static bool openSpool(multipart_Generator * const self)
+{
+	const char * dir = NULL;
+	
+	if(self->spoolDir and self->spoolDir != Py_None)
+	{
+		dir = PyString_AsString(self->spoolDir);
+		if(not dir)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		dir = getenv("TMPDIR");
+		if(not dir or not *dir)
+		{
+			dir = "/tmp";
+		}
+	}
+	
+	PyObject * const path = PyString_FromFormat("%s/multipart-XXXXXX",dir);
+	
+	if(not path)
+	{
+		return false;
+	}
+	
+	self->spoolFd = mkstemp(PyString_AS_STRING(path));
+	
+	if(self->spoolFd == -1)
+	{
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError,PyString_AS_STRING(path));
+		Py_DECREF(path);
+		return false;
+	}
+	
+	unlink(PyString_AS_STRING(path));
+	Py_DECREF(path);
+	return true;
+}
+
+int multipart_Generator_spool(PyObject * const generator, const char * data, size_t length)
+{
+	multipart_Generator * const self = (multipart_Generator*)generator;
+	
+	if(self->spoolThreshold == 0)
+	{
+		return 0;
+	}
+	
+	//Stay in memory until the threshold is crossed, and keep spooling
+	//until the file has been read back so the order is preserved
+	if(self->spoolRead == self->spoolWrite and self->queuedBytes + length <= self->spoolThreshold)
+	{
+		return 0;
+	}
+	
+	if(self->spoolFd == -1 and not openSpool(self))
+	{
+		return -1;
+	}
+	
+	size_t done = 0;
+	
+	while(done < length)
+	{
+		ssize_t result;
+		Py_BEGIN_ALLOW_THREADS
+		result = pwrite(self->spoolFd,data + done,length - done,self->spoolWrite + done);
+		Py_END_ALLOW_THREADS
+		
+		if(result < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			PyErr_SetFromErrno(PyExc_IOError);
+			return -1;
+		}
+		done += result;
+	}
+	
+	self->spoolWrite += length;
+	return 1;
+}
+
 static PyObject * Generator_push(multipart_Generator * self, PyObject *args, PyObject *kwds)
 {
 	PyObject * item;
@@ -106,6 +443,18 @@ static PyObject * Generator_push(multipart_Generator * self, PyObject *args, PyO
 	
 	Py_INCREF(item);
 	
+	if(not multipart_Generator_push((PyObject*)self,item))
+	{
+		return NULL;
+	}
+	
+	Py_RETURN_NONE;
+}
+
+bool multipart_Generator_push(PyObject * const generator, PyObject * const item)
+{
+	multipart_Generator * const self = (multipart_Generator*)generator;
+	
 	const size_t newLength = self->queueLength +1;
 	
 	if(newLength >= self->queueSize)
@@ -127,8 +476,9 @@ static PyObject * Generator_push(multipart_Generator * self, PyObject *args, PyO
 
 			if(not replacement)
 			{
+				Py_DECREF(item);
 				PyErr_NoMemory();
-				return NULL;
+				return false;
 			}
 			self->queue = replacement;
 			self->queueSize = NEW_SIZE;
@@ -138,7 +488,14 @@ static PyObject * Generator_push(multipart_Generator * self, PyObject *args, PyO
 	self->queue[self->queueLength] = item;
 	self->queueLength += 1;
 	
-	Py_RETURN_NONE;
+	const size_t size = itemSize(item);
+	self->queuedBytes += size;
+	if(self->account)
+	{
+		*self->account += size;
+	}
+	
+	return true;
 }
 
 static PyMethodDef Generator_methods[] = 
@@ -147,7 +504,10 @@ static PyMethodDef Generator_methods[] =
 	{"done",(PyCFunction)Generator_done,METH_KEYWORDS,"signal the iterator to end the data stream"},
 	{NULL} 
 };
-static PyMemberDef Generator_members[] = { {NULL} };
+static PyMemberDef Generator_members[] = {
+	{"digests",T_OBJECT,offsetof(multipart_Generator,digests),READONLY,"dict of hex digests of the data once it is complete, or None"},
+	{NULL}
+};
 
 static int Generator_init(multipart_Generator * self, PyObject *args, PyObject *kwds)
 {
@@ -161,24 +521,47 @@ static int Generator_init(multipart_Generator * self, PyObject *args, PyObject *
 	self->callback = callback;
 	Py_INCREF(self->callback);
 	
+	if(not allocateQueue(self))
+	{
+		return -1;
+	}
 	
-	static const int STARTING_SIZE = 4;
-	const int SIZE_BYTES = sizeof(PyObject*)*STARTING_SIZE;
-
-	self->queueSize = STARTING_SIZE;
+	return 0;
+}
 
-	self->queue = PyMem_Malloc(SIZE_BYTES);
-	if(not self->queue)
+//Sets up a generator made by tp_alloc or taken from a free list to pull
+//from owner
+static PyObject * ownedBy(multipart_Generator * const self, PyObject * const owner, multipart_Generator_pull const pull)
+{
+	if(not self->queue and not allocateQueue(self))
 	{
-		PyErr_NoMemory();
+		Py_DECREF(self);
 		return NULL;
 	}
-	bzero(self->queue,SIZE_BYTES);
 	
-	return 0;
+	self->owner = owner;
+	Py_INCREF(owner);
+	self->pull = pull;
+	
+	return (PyObject*)self;
 }
 
-
+PyObject * multipart_Generator_new(PyObject * const owner, multipart_Generator_pull const pull)
+{
+	multipart_Generator * self = reuse(&generatorFreeList,&multipart_GeneratorType);
+	
+	if(not self)
+	{
+		self = (multipart_Generator*)Generator_new(&multipart_GeneratorType,NULL,NULL);
+	}
+	
+	if(not self)
+	{
+		return NULL;
+	}
+	
+	return ownedBy(self,owner,pull);
+}
 
 PyTypeObject multipart_GeneratorType = {
 	PyObject_HEAD_INIT(NULL)
@@ -225,3 +608,167 @@ PyTypeObject multipart_GeneratorType = {
 };
 
 
+
+//A part of a multipart body: a generator of the part's data that also
+//carries the part's headers, so the parser hands out a single object
+typedef struct
+{
+	multipart_Generator generator;
+	PyObject * headers;
+	
+	//All of the data as one string once it is known to be small, or NULL
+	PyObject * value;
+}multipart_Part;
+
+static void Part_dealloc(multipart_Part * self)
+{
+	Py_CLEAR(self->headers);
+	Py_CLEAR(self->value);
+	releaseGenerator(&self->generator);
+	
+	if(Py_TYPE(self) == &multipart_PartType and recycle(&partFreeList,&self->generator))
+	{
+		return;
+	}
+	
+	PyMem_Free(self->generator.queue);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+PyObject * multipart_Part_new(PyObject * const owner, multipart_Generator_pull const pull, PyObject * const headers)
+{
+	multipart_Part * self = (multipart_Part*)reuse(&partFreeList,&multipart_PartType);
+	
+	if(not self)
+	{
+		self = (multipart_Part*)Generator_new(&multipart_PartType,NULL,NULL);
+	}
+	
+	if(not self)
+	{
+		return NULL;
+	}
+	
+	Py_INCREF(headers);
+	self->headers = headers;
+	self->value = NULL;
+	
+	return ownedBy(&self->generator,owner,pull);
+}
+
+int multipart_Part_settle(PyObject * const part, size_t const threshold)
+{
+	multipart_Part * const self = (multipart_Part*)part;
+	multipart_Generator * const generator = &self->generator;
+	
+	if(self->value)
+	{
+		return 1;
+	}
+	
+	//Too large, or already on its way to the temporary file
+	if(generator->queuedBytes > threshold or generator->spoolRead < generator->spoolWrite)
+	{
+		return 1;
+	}
+	
+	if(not generator->done)
+	{
+		return 0;
+	}
+	
+	const size_t count = generator->queueLength - generator->queueRead;
+	PyObject * value;
+	
+	if(count == 1 and PyString_CheckExact(generator->queue[generator->queueRead]))
+	{
+		value = generator->queue[generator->queueRead];
+		Py_INCREF(value);
+	}
+	else
+	{
+		value = PyString_FromStringAndSize(NULL,generator->queuedBytes);
+		
+		if(not value)
+		{
+			return -1;
+		}
+		
+		char * out = PyString_AS_STRING(value);
+		
+		for(size_t i = generator->queueRead; i < generator->queueLength; ++i)
+		{
+			const void * data;
+			Py_ssize_t length;
+			
+			if(PyObject_AsReadBuffer(generator->queue[i],&data,&length) == -1)
+			{
+				Py_DECREF(value);
+				return -1;
+			}
+			memcpy(out,data,length);
+			out += length;
+		}
+		
+		//The queue is left holding the value alone, which has the
+		//same length as the items it replaces
+		for(size_t i = generator->queueRead; i < generator->queueLength; ++i)
+		{
+			Py_DECREF(generator->queue[i]);
+		}
+		
+		generator->queueRead = 0;
+		generator->queueLength = 0;
+		
+		if(count != 0)
+		{
+			Py_INCREF(value);
+			generator->queue[0] = value;
+			generator->queueLength = 1;
+		}
+	}
+	
+	self->value = value;
+	return 1;
+}
+
+static PyMemberDef Part_members[] = {
+	{"headers",T_OBJECT,offsetof(multipart_Part,headers),READONLY,"headers of the part"},
+	{"value",T_OBJECT,offsetof(multipart_Part,value),READONLY,"all of the data of a small part as a string, or None if it is streamed"},
+	{NULL}
+};
+
+PyTypeObject multipart_PartType = {
+	PyObject_HEAD_INIT(NULL)
+	0,                         /*ob_size*/
+    "multipart.Part",             /*tp_name*/
+    sizeof(multipart_Part), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)Part_dealloc          ,/*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_HAVE_CLASS | Py_TPFLAGS_HAVE_ITER,        /*tp_flags*/
+    "Part object, iterating over the data of a part",           /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    0,             /* tp_methods */
+    Part_members,             /* tp_members */
+    0,                         /* tp_getset */
+    &multipart_GeneratorType,                         /* tp_base */
+};
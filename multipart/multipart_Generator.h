@@ -4,6 +4,51 @@
 #ifndef __multipart_Generator
 #define __multipart_Generator
 
+#include "stdbool.h"
+
 extern PyTypeObject multipart_GeneratorType;
+extern PyTypeObject multipart_PartType;
+
+//Called by a native generator whenever its queue is empty and it is not
+//done. Returns false with an exception set on failure.
+typedef bool (*multipart_Generator_pull)(PyObject * owner);
+
+//Creates a generator that calls pull(owner) for more items, without
+//going through Python calls. The generator keeps a reference to owner.
+PyObject * multipart_Generator_new(PyObject * owner, multipart_Generator_pull pull);
+
+//Creates a multipart.Part, a native generator of a part's data whose
+//headers attribute is headers
+PyObject * multipart_Part_new(PyObject * owner, multipart_Generator_pull pull, PyObject * headers);
+
+//Sets the value attribute of a part whose data is complete, in memory
+//and at most threshold bytes long. Returns 1 once that has been decided
+//either way, 0 if the part needs more data first and -1 with an exception
+//set on failure.
+int multipart_Part_settle(PyObject * part, size_t threshold);
+
+//Appends item to the queue, stealing the reference to it. Returns false
+//with an exception set on failure.
+bool multipart_Generator_push(PyObject * self, PyObject * item);
+
+//Signals that no more items will be pushed
+void multipart_Generator_done(PyObject * self);
+
+//Sets the dict of digests reported by the generator's digests attribute
+void multipart_Generator_setDigests(PyObject * self, PyObject * digests);
+
+//Makes the generator add the length of each queued string or buffer to
+//*account, and subtract it again once the item leaves the queue
+void multipart_Generator_account(PyObject * self, size_t * account);
+
+//Makes the generator move data to an unlinked temporary file in dir
+//(a string, or None for the default) once more than threshold bytes
+//would be queued in memory
+void multipart_Generator_spoolAfter(PyObject * self, size_t threshold, PyObject * dir);
+
+//Writes data to the generator's temporary file if it is spooling.
+//Returns 1 if the data was spooled, 0 if it should be pushed as an item
+//instead and -1 with an exception set on failure.
+int multipart_Generator_spool(PyObject * self, const char * data, size_t length);
 
 #endif
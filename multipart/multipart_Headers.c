@@ -0,0 +1,454 @@
+#include "multipart_Headers.h"
+#include "iso646.h"
+#include <ctype.h>
+#include <strings.h>
+
+typedef struct
+{
+	PyDictObject dict;
+	
+	//Parsed from Content-Disposition
+	PyObject * name;
+	PyObject * filename;
+	//Parsed from Content-Type
+	PyObject * contentType;
+	PyObject * charset;
+}multipart_Headers;
+
+//Header names that are looked up often enough to be worth sharing
+static char const * const COMMON_NAMES[] = {
+	"content-disposition",
+	"content-type",
+	"content-transfer-encoding",
+	"content-length",
+	"content-id",
+	"content-description"
+};
+#define COMMON_NAME_COUNT (sizeof(COMMON_NAMES)/sizeof(COMMON_NAMES[0]))
+static PyObject * commonNames[COMMON_NAME_COUNT];
+
+//Returns a borrowed reference to a common name, creating it on first use
+static PyObject * commonName(size_t const index)
+{
+	if(not commonNames[index])
+	{
+		commonNames[index] = PyString_InternFromString(COMMON_NAMES[index]);
+	}
+	return commonNames[index];
+}
+
+static PyObject * headerName(char const * const field, size_t const length)
+{
+	for(size_t i = 0; i < COMMON_NAME_COUNT; i++)
+	{
+		if(strlen(COMMON_NAMES[i]) == length and strncasecmp(COMMON_NAMES[i],field,length) == 0)
+		{
+			PyObject * const name = commonName(i);
+			Py_XINCREF(name);
+			return name;
+		}
+	}
+	
+	PyObject * const name = PyString_FromStringAndSize(NULL,length);
+	if(name)
+	{
+		char * const lower = PyString_AS_STRING(name);
+		for(size_t i = 0; i < length; i++)
+		{
+			lower[i] = tolower((unsigned char)field[i]);
+		}
+	}
+	return name;
+}
+
+PyObject * multipart_Headers_new(void)
+{
+	//dict's own tp_new sets up the table, and it ignores its arguments
+	PyObject * const args = PyTuple_New(0);
+	if(not args)
+	{
+		return NULL;
+	}
+	
+	PyObject * const self = PyDict_Type.tp_new(&multipart_HeadersType,args,NULL);
+	Py_DECREF(args);
+	return self;
+}
+
+//Stores item under key. A name that is already there has its values
+//collected in a list, in the order they were sent.
+static bool addValue(PyObject * const self, PyObject * const key, PyObject * const item)
+{
+	PyObject * const previous = PyDict_GetItem(self,key);
+	
+	if(not previous)
+	{
+		return PyDict_SetItem(self,key,item) == 0;
+	}
+	if(PyList_CheckExact(previous))
+	{
+		return PyList_Append(previous,item) == 0;
+	}
+	
+	PyObject * const values = PyList_New(2);
+	if(not values)
+	{
+		return false;
+	}
+	Py_INCREF(previous);
+	PyList_SET_ITEM(values,0,previous);
+	Py_INCREF(item);
+	PyList_SET_ITEM(values,1,item);
+	
+	const bool ok = PyDict_SetItem(self,key,values) == 0;
+	Py_DECREF(values);
+	return ok;
+}
+
+bool multipart_Headers_add(PyObject * const self, char const * const field, size_t const fieldLength, char const * const value, size_t const valueLength)
+{
+	PyObject * const key = headerName(field,fieldLength);
+	PyObject * const item = key ? PyString_FromStringAndSize(value,valueLength) : NULL;
+	const bool ok = item and addValue(self,key,item);
+	
+	Py_XDECREF(key);
+	Py_XDECREF(item);
+	return ok;
+}
+
+//The value of a header that is parsed further, the first one if the
+//name was repeated. A borrowed reference, NULL if there is none.
+static PyObject * firstValue(PyObject * const self, PyObject * const key)
+{
+	PyObject * const value = PyDict_GetItem(self,key);
+	
+	if(value and PyList_CheckExact(value))
+	{
+		return PyList_GET_ITEM(value,0);
+	}
+	return value;
+}
+
+//Looks for parameter key in a header value such as
+//'form-data; name="a"'. Sets *at and *length to the span of its value,
+//without quotes, and *quoted if it was a quoted string.
+static bool findParameter(char const * const s, size_t const length, char const * const key, char const ** const at, size_t * const valueLength, bool * const quoted)
+{
+	const size_t keyLength = strlen(key);
+	char const * const semicolon = memchr(s,';',length);
+	size_t i = semicolon ? (size_t)(semicolon - s) : length;
+	
+	while(i < length)
+	{
+		//At a ';'
+		i++;
+		while(i < length and (s[i] == ' ' or s[i] == '\t'))
+		{
+			i++;
+		}
+		
+		const size_t nameBegin = i;
+		while(i < length and s[i] != '=' and s[i] != ';')
+		{
+			i++;
+		}
+		size_t nameEnd = i;
+		while(nameEnd > nameBegin and (s[nameEnd-1] == ' ' or s[nameEnd-1] == '\t'))
+		{
+			nameEnd--;
+		}
+		
+		if(i == length or s[i] == ';')
+		{
+			continue;
+		}
+		
+		//Past the '='
+		i++;
+		while(i < length and (s[i] == ' ' or s[i] == '\t'))
+		{
+			i++;
+		}
+		
+		size_t valueBegin;
+		size_t valueEnd;
+		bool isQuoted = i < length and s[i] == '"';
+		
+		if(isQuoted)
+		{
+			valueBegin = ++i;
+			while(i < length and s[i] != '"')
+			{
+				i += (s[i] == '\\' and i + 1 < length) ? 2 : 1;
+			}
+			valueEnd = i < length ? i : length;
+		}
+		else
+		{
+			valueBegin = i;
+			while(i < length and s[i] != ';')
+			{
+				i++;
+			}
+			valueEnd = i;
+			while(valueEnd > valueBegin and (s[valueEnd-1] == ' ' or s[valueEnd-1] == '\t'))
+			{
+				valueEnd--;
+			}
+		}
+		
+		while(i < length and s[i] != ';')
+		{
+			i++;
+		}
+		
+		if(nameEnd - nameBegin == keyLength and strncasecmp(s + nameBegin,key,keyLength) == 0)
+		{
+			*at = s + valueBegin;
+			*valueLength = valueEnd - valueBegin;
+			*quoted = isQuoted;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+//The value of parameter key as a string, None if it is missing
+static PyObject * parameter(char const * const s, size_t const length, char const * const key, bool const lower)
+{
+	char const * at;
+	size_t valueLength;
+	bool quoted;
+	
+	if(not findParameter(s,length,key,&at,&valueLength,&quoted))
+	{
+		Py_RETURN_NONE;
+	}
+	
+	PyObject * value = PyString_FromStringAndSize(NULL,valueLength);
+	if(not value)
+	{
+		return NULL;
+	}
+	
+	char * const out = PyString_AS_STRING(value);
+	size_t n = 0;
+	for(size_t i = 0; i < valueLength; i++)
+	{
+		//Quoted strings escape characters with a backslash
+		if(quoted and at[i] == '\\' and i + 1 < valueLength)
+		{
+			i++;
+		}
+		out[n++] = lower ? tolower((unsigned char)at[i]) : at[i];
+	}
+	
+	_PyString_Resize(&value,n);
+	return value;
+}
+
+static int hexValue(char const c)
+{
+	if(c >= '0' and c <= '9')
+	{
+		return c - '0';
+	}
+	if(c >= 'A' and c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+	if(c >= 'a' and c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+//Decodes an RFC 5987 extended value such as UTF-8''%e2%82%ac.txt to a
+//unicode object. Returns None if there is none or it cannot be decoded.
+static PyObject * extendedParameter(char const * const s, size_t const length, char const * const key)
+{
+	char const * at;
+	size_t valueLength;
+	bool quoted;
+	
+	if(not findParameter(s,length,key,&at,&valueLength,&quoted))
+	{
+		Py_RETURN_NONE;
+	}
+	
+	//charset'language'percent-encoded
+	char const * const end = at + valueLength;
+	char const * const charsetEnd = memchr(at,'\'',valueLength);
+	char const * const languageEnd = charsetEnd ? memchr(charsetEnd + 1,'\'',end - charsetEnd - 1) : NULL;
+	
+	if(not languageEnd or charsetEnd == at or charsetEnd - at > 32)
+	{
+		Py_RETURN_NONE;
+	}
+	
+	char charset[33];
+	memcpy(charset,at,charsetEnd - at);
+	charset[charsetEnd - at] = '\0';
+	
+	char * const bytes = PyMem_Malloc(end - languageEnd);
+	if(not bytes)
+	{
+		return PyErr_NoMemory();
+	}
+	
+	size_t n = 0;
+	for(char const * c = languageEnd + 1; c < end; c++)
+	{
+		if(*c == '%' and c + 2 < end and hexValue(c[1]) >= 0 and hexValue(c[2]) >= 0)
+		{
+			bytes[n++] = hexValue(c[1]) << 4 | hexValue(c[2]);
+			c += 2;
+		}
+		else
+		{
+			bytes[n++] = *c;
+		}
+	}
+	
+	PyObject * const decoded = PyUnicode_Decode(bytes,n,charset,"strict");
+	PyMem_Free(bytes);
+	
+	//An unknown charset or bad bytes leave the plain parameter to be used
+	if(not decoded)
+	{
+		PyErr_Clear();
+		Py_RETURN_NONE;
+	}
+	return decoded;
+}
+
+bool multipart_Headers_complete(PyObject * const object)
+{
+	multipart_Headers * const self = (multipart_Headers*)object;
+	
+	PyObject * const dispositionName = commonName(0);
+	PyObject * const contentTypeName = commonName(1);
+	if(not dispositionName or not contentTypeName)
+	{
+		return false;
+	}
+	
+	PyObject * const disposition = firstValue(object,dispositionName);
+	if(disposition and PyString_Check(disposition))
+	{
+		char const * const s = PyString_AS_STRING(disposition);
+		const size_t length = PyString_GET_SIZE(disposition);
+		
+		Py_XSETREF(self->name,parameter(s,length,"name",false));
+		if(not self->name)
+		{
+			return false;
+		}
+		
+		//filename* takes precedence over the plain filename
+		PyObject * filename = extendedParameter(s,length,"filename*");
+		if(filename == Py_None)
+		{
+			Py_DECREF(filename);
+			filename = parameter(s,length,"filename",false);
+		}
+		Py_XSETREF(self->filename,filename);
+		if(not self->filename)
+		{
+			return false;
+		}
+	}
+	
+	PyObject * const contentType = firstValue(object,contentTypeName);
+	if(contentType and PyString_Check(contentType))
+	{
+		char const * const s = PyString_AS_STRING(contentType);
+		const size_t length = PyString_GET_SIZE(contentType);
+		char const * const semicolon = memchr(s,';',length);
+		size_t end = semicolon ? (size_t)(semicolon - s) : length;
+		size_t begin = 0;
+		
+		while(begin < end and (s[begin] == ' ' or s[begin] == '\t'))
+		{
+			begin++;
+		}
+		while(end > begin and (s[end-1] == ' ' or s[end-1] == '\t'))
+		{
+			end--;
+		}
+		
+		PyObject * const type = PyString_FromStringAndSize(s + begin,end - begin);
+		if(not type)
+		{
+			return false;
+		}
+		for(size_t i = 0; i < end - begin; i++)
+		{
+			PyString_AS_STRING(type)[i] = tolower((unsigned char)PyString_AS_STRING(type)[i]);
+		}
+		Py_XSETREF(self->contentType,type);
+		
+		Py_XSETREF(self->charset,parameter(s,length,"charset",true));
+		if(not self->charset)
+		{
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+static void Headers_dealloc(multipart_Headers * const self)
+{
+	PyObject_GC_UnTrack(self);
+	Py_CLEAR(self->name);
+	Py_CLEAR(self->filename);
+	Py_CLEAR(self->contentType);
+	Py_CLEAR(self->charset);
+	PyDict_Type.tp_dealloc((PyObject*)self);
+}
+
+static PyMemberDef Headers_members[] = {
+	{"name",T_OBJECT,offsetof(multipart_Headers,name),READONLY,"name parameter of Content-Disposition, or None"},
+	{"filename",T_OBJECT,offsetof(multipart_Headers,filename),READONLY,"filename of Content-Disposition, decoded from filename* if given, or None"},
+	{"content_type",T_OBJECT,offsetof(multipart_Headers,contentType),READONLY,"lowercased media type of Content-Type, or None"},
+	{"charset",T_OBJECT,offsetof(multipart_Headers,charset),READONLY,"lowercased charset parameter of Content-Type, or None"},
+	{NULL}
+};
+
+PyTypeObject multipart_HeadersType = {
+	PyObject_HEAD_INIT(NULL)
+	0,                         /*ob_size*/
+    "multipart.Headers",             /*tp_name*/
+    sizeof(multipart_Headers), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)Headers_dealloc,/*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Headers of a part, keyed by lowercased name. A repeated name maps to the list of its values.",           /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    0,             /* tp_methods */
+    Headers_members,             /* tp_members */
+    0,                         /* tp_getset */
+    &PyDict_Type,                         /* tp_base */
+};
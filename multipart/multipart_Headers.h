@@ -0,0 +1,25 @@
+#include <Python.h>
+#include <structmember.h>
+
+#ifndef __multipart_Headers
+#define __multipart_Headers
+
+#include "stdbool.h"
+
+extern PyTypeObject multipart_HeadersType;
+
+//Creates an empty dict of headers
+PyObject * multipart_Headers_new(void);
+
+//Adds a header, keyed by its lowercased name. Common names are shared
+//interned strings. The values of a repeated name are kept in a list.
+//Returns false with an exception set on failure.
+bool multipart_Headers_add(PyObject * self, char const * field, size_t fieldLength, char const * value, size_t valueLength);
+
+//Parses Content-Disposition and Content-Type into the name, filename,
+//content_type and charset attributes once all headers are added. The
+//first of repeated headers is the one parsed.
+//Returns false with an exception set on failure.
+bool multipart_Headers_complete(PyObject * self);
+
+#endif
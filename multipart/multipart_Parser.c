@@ -6,6 +6,18 @@
 #include "iso646.h"
 #include "stdbool.h"
 #include "multipart_parser.h"
+#include "multipart_Generator.h"
+#include "multipart_Headers.h"
+#include "multipart_events.h"
+#include "multipart_digest.h"
+#include "multipart_decode.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 struct multipart_Parser;
 typedef struct multipart_Parser multipart_Parser;
@@ -13,18 +25,54 @@ struct multipart_Parser {
 	PyObject_HEAD
 	multipart_parser * parser;
 	
-	//The field of the header currently being parsed
-	char * headerFieldInProgress;
-	size_t headerFieldLength;
-	size_t headerFieldSize;
+	//All header bytes of the current part are appended here, and
+	//dropped in one go once its headers are complete
+	char * headerArena;
+	size_t headerArenaLength;
+	size_t headerArenaSize;
 	
-	//The value of the header currently being parsed
-	char * headerValueInProgress;
+	//The field and value of the header currently being parsed, as
+	//offsets into headerArena
+	size_t headerFieldOffset;
+	size_t headerFieldLength;
+	size_t headerValueOffset;
 	size_t headerValueLength;
-	size_t headerValueSize;
 	
 	char * data;
 	
+	//Part data spans shorter than minChunk are gathered here and
+	//pushed as one chunk. Zero disables coalescing.
+	size_t minChunk;
+	char * pendingData;
+	size_t pendingLength;
+	size_t pendingSize;
+	
+	//When true, part data is handed out as read-only buffer objects
+	//that reference the input chunk instead of copies of it
+	bool zeroCopy;
+	//The chunk currently being parsed and its raw bytes
+	PyObject * input;
+	char const * inputData;
+	size_t inputLength;
+	//A chunk the parser paused in, resumed at pausedOffset by the next
+	//pull before any more input is read
+	PyObject * pausedInput;
+	size_t pausedOffset;
+	
+	//Input is pulled from fin in one of four ways. An object with the
+	//buffer protocol, like an mmap, is parsed whole as mapping. A
+	//file-like object with readinto fills readBuffer, one with read
+	//returns a block per call, and anything else is iterated.
+	enum { READ_ITERATE, READ_READ, READ_READINTO, READ_MAPPED } readMode;
+	PyObject * readMethod;
+	PyObject * mapping;
+	//The bytearray reused by readinto for each block
+	PyObject * readBuffer;
+	size_t blockSize;
+	//Bytes left to read from fin when its length is known, so a socket
+	//is never asked for more than the body. -1 if unknown.
+	Py_ssize_t remaining;
+	
 	//The callable object that reads data
 	PyObject * readIterator;
 	//The number of bytes read from the iterator
@@ -40,9 +88,76 @@ struct multipart_Parser {
 	size_t iteratorQueueSizeInPairs;
 	ssize_t currentIteratorPair;
 	ssize_t outgoingIteratorPair;
+	//Pairs before this one are no longer referenced by the parser
+	ssize_t releasedIteratorPair;
+	
+	//When true, the C parser runs with the GIL released and records
+	//its callbacks in events. They are replayed once it is reacquired.
+	bool releaseGil;
+	multipart_events events;
+	//Set while a chunk is being parsed, to refuse reentrant reads
+	bool parsing;
+	
+	//Bytes of part data queued in iterators but not yet read, and the
+	//most that may be queued before the parser stops pulling input.
+	//Zero means no limit. The parser pauses mid-chunk to stay within it,
+	//so it cannot be combined with releaseGil, where a whole chunk is
+	//parsed before any of its data is queued.
+	size_t bufferedBytes;
+	size_t maxBuffer;
+	
+	//Part data beyond this many unread bytes is moved to a temporary
+	//file in spoolDir. Zero never spools.
+	size_t spoolThreshold;
+	PyObject * spoolDir;
+	
+	//Called with the header list of each part. When it returns a file
+	//descriptor (or an object with fileno), the part's data is written
+	//straight to it and its data iterator stays empty.
+	PyObject * sink;
+	//The headers of the current part, only collected for the sink
+	PyObject * partHeaders;
+	//What the sink returned for the current part and its descriptor
+	PyObject * sinkTarget;
+	int sinkFd;
+	//Data from outside the input chunk, held back so it can go out in
+	//the same writev as the span after it
+	char * sinkCarry;
+	size_t sinkCarryLength;
+	size_t sinkCarrySize;
+	
+	//The digests computed over the data of each part, as a mask of
+	//multipart_digest_kind, and their state for the current part
+	unsigned digestKinds;
+	multipart_digest digest;
+	
+	//When decode is set, part data is decoded according to the part's
+	//Content-Transfer-Encoding header into the scratch buffer decoded
+	bool decode;
+	multipart_decoder decoder;
+	char * decoded;
+	size_t decodedSize;
+	
+	//When set, each part's headers are a multipart.Headers dict instead
+	//of an iterator of tuples, handed out once they are complete
+	bool structuredHeaders;
+	
+	//When set, each part is handed out as one multipart.Part instead of
+	//a (headers, data) tuple of two iterators. Its headers are a list of
+	//tuples, or a Headers dict, which is complete once the part is.
+	bool parts;
+	
+	//Parts whose data completes within this many bytes are only handed
+	//out once it has, with the data as their value. Zero to disable.
+	size_t eagerThreshold;
+	
+	//Limits enforced by the parser on hostile input
+	multipart_parser_limits limits;
 	
 } ;
 
+PyObject * multipart_LimitError = NULL;
+
 static PyObject* Parser_new(PyTypeObject * type, PyObject * args, PyObject * kwds)
 {
 	multipart_Parser * self = (multipart_Parser*)type->tp_alloc(type,0);
@@ -54,6 +169,31 @@ static PyObject* Parser_new(PyTypeObject * type, PyObject * args, PyObject * kwd
 		self->iteratorQueueSizeInPairs = 0;
 		self->currentIteratorPair = -1;
 		self->outgoingIteratorPair = 0;
+		self->releasedIteratorPair = 0;
+		self->releaseGil = false;
+		multipart_events_init(&self->events);
+		self->parsing = false;
+		self->bufferedBytes = 0;
+		self->maxBuffer = 0;
+		self->spoolThreshold = 0;
+		self->spoolDir = NULL;
+		
+		self->sink = NULL;
+		self->partHeaders = NULL;
+		self->sinkTarget = NULL;
+		self->sinkFd = -1;
+		self->sinkCarry = NULL;
+		self->sinkCarryLength = 0;
+		self->sinkCarrySize = 0;
+		self->digestKinds = 0;
+		self->decode = false;
+		multipart_decoder_init(&self->decoder,MULTIPART_ENCODING_IDENTITY);
+		self->decoded = NULL;
+		self->decodedSize = 0;
+		self->structuredHeaders = false;
+		self->parts = false;
+		self->eagerThreshold = 0;
+		memset(&self->limits,0,sizeof(self->limits));
 		
 		self->parser = NULL;
 		self->bytesParsed = 0;
@@ -61,22 +201,38 @@ static PyObject* Parser_new(PyTypeObject * type, PyObject * args, PyObject * kwd
 		self->headersComplete = true;
 		self->dataComplete = false;
 		self->readIterator = NULL;
-		static const int STARTING_SIZE = 3;
-		self->headerFieldInProgress = PyMem_Malloc(STARTING_SIZE*sizeof(char));
-		self->headerFieldLength = 0;
-		self->headerFieldSize = STARTING_SIZE;
+		self->readMode = READ_ITERATE;
+		self->readMethod = NULL;
+		self->mapping = NULL;
+		self->readBuffer = NULL;
+		self->blockSize = 0;
+		self->remaining = -1;
 		
-		self->headerValueInProgress = PyMem_Malloc(STARTING_SIZE*sizeof(char));
+		self->zeroCopy = false;
+		self->input = NULL;
+		self->inputData = NULL;
+		self->inputLength = 0;
+		self->pausedInput = NULL;
+		self->pausedOffset = 0;
+		
+		self->minChunk = 0;
+		self->pendingData = NULL;
+		self->pendingLength = 0;
+		self->pendingSize = 0;
+		//Enough for the headers of a typical part
+		static const size_t STARTING_SIZE = 512;
+		self->headerArena = PyMem_Malloc(STARTING_SIZE);
+		self->headerArenaLength = 0;
+		self->headerArenaSize = STARTING_SIZE;
+		self->headerFieldOffset = 0;
+		self->headerFieldLength = 0;
+		self->headerValueOffset = 0;
 		self->headerValueLength = 0;
-		self->headerValueSize = STARTING_SIZE;
 		
-		//If memory allocation fails in either case,
-		//give up.
-		if( self->headerFieldInProgress == NULL or self->headerValueInProgress == NULL)
+		//If memory allocation fails, give up.
+		if( self->headerArena == NULL )
 		{
-			PyMem_Free(self->headerFieldInProgress);
-			PyMem_Free(self->headerValueInProgress);
-			PyMem_Free(self);
+			Py_TYPE(self)->tp_free(self);
 			return PyErr_NoMemory();
 		}		
 	}
@@ -91,10 +247,21 @@ static void Parser_dealloc(multipart_Parser * self)
 		multipart_parser_free(self->parser);
 	}
 	
-	PyMem_Free(self->headerFieldInProgress);
-	PyMem_Free(self->headerValueInProgress);
+	PyMem_Free(self->headerArena);
+	PyMem_Free(self->pendingData);
+	PyMem_Free(self->decoded);
 	
 	Py_XDECREF(self->readIterator);
+	Py_XDECREF(self->readMethod);
+	Py_XDECREF(self->mapping);
+	Py_XDECREF(self->pausedInput);
+	Py_XDECREF(self->readBuffer);
+	Py_XDECREF(self->spoolDir);
+	Py_XDECREF(self->sink);
+	Py_XDECREF(self->partHeaders);
+	Py_XDECREF(self->sinkTarget);
+	PyMem_Free(self->sinkCarry);
+	multipart_events_free(&self->events);
 	
 	for(size_t i = 0;i < self->iteratorQueueLengthInPairs ; i++)
 	{
@@ -103,8 +270,33 @@ static void Parser_dealloc(multipart_Parser * self)
 	}
 	
 	PyMem_Free(self->iteratorQueue);
+	Py_TYPE(self)->tp_free((PyObject*)self);
 }
   
+static bool Parser_pull(PyObject * self);
+
+//Drops the parser's references to the iterators of parts that are both
+//finished and handed out. Once the consumer lets go of them too, their
+//queued data is freed. The last part is finished once the body is, and
+//has to be let go as well, since its iterators refer back to the parser.
+static void releaseFinishedPairs(multipart_Parser * const self)
+{
+	while(self->releasedIteratorPair < self->outgoingIteratorPair and
+	      (self->releasedIteratorPair < self->currentIteratorPair or self->dataComplete))
+	{
+		Py_CLEAR(self->iteratorQueue[self->releasedIteratorPair*2]);
+		Py_CLEAR(self->iteratorQueue[self->releasedIteratorPair*2+1]);
+		self->releasedIteratorPair += 1;
+	}
+}
+
+//True if the data iterator of the current part was handed out and then
+//dropped by the consumer, so its data would never be read
+static bool currentDataAbandoned(multipart_Parser * const self)
+{
+	return self->currentIteratorPair < self->outgoingIteratorPair and Py_REFCNT(self->iteratorQueue[self->currentIteratorPair*2+1]) == 1;
+}
+
 static bool queuePush(multipart_Parser * const self)
 {
 	
@@ -128,33 +320,27 @@ static bool queuePush(multipart_Parser * const self)
 		self->iteratorQueueSizeInPairs = NEW_SIZE;
 	}
 	
-	//Retrieve the generator constructor
-	PyObject * const generatorObject = PyObject_GetAttrString(multipartModule,"Generator");
+	//Construct two iterators, both of which pull more input from
+	//this object directly when they run dry. A part holds its headers
+	//itself, which are then collected into a list or dict.
+	PyObject * headerIterator;
 	
-	if(not generatorObject)
+	if(self->structuredHeaders)
 	{
-		PyErr_SetString(PyExc_NameError,"Cannot find multipart.Generator");
-		return false;
+		headerIterator = multipart_Headers_new();
 	}
-	
-	//Retrieve this objects own read method
-	PyObject * const read = PyObject_GetAttrString((PyObject*)self,"read");
-	
-	if(not read)
+	else if(self->parts)
 	{
-		PyErr_SetString(PyExc_NameError,"Could not find self.read");
-		return false;
+		headerIterator = PyList_New(0);
+	}
+	else
+	{
+		headerIterator = multipart_Generator_new((PyObject*)self,Parser_pull);
 	}
 	
-	//Construct two iterators, both being passed the read method
-	//of this object
-	PyObject * const argument = PyTuple_Pack(1,read);
-	Py_DECREF(read);
-	
-	PyObject * const headerIterator = PyObject_Call(generatorObject,argument,NULL);
-	PyObject * const bodyIterator = PyObject_Call(generatorObject,argument,NULL);
-	Py_DECREF(argument);
-	Py_DECREF(generatorObject);
+	PyObject * const bodyIterator = not headerIterator ? NULL :
+	                                self->parts ? multipart_Part_new((PyObject*)self,Parser_pull,headerIterator) :
+	                                multipart_Generator_new((PyObject*)self,Parser_pull);
 	
 	if(not headerIterator or not bodyIterator)
 	{	
@@ -163,7 +349,6 @@ static bool queuePush(multipart_Parser * const self)
 		
 		self->currentIteratorPair-=1;
 		
-		PyErr_NoMemory();
 		return false;
 	}
 	
@@ -172,139 +357,366 @@ static bool queuePush(multipart_Parser * const self)
 	//data.
 	self->iteratorQueue[self->currentIteratorPair*2] = headerIterator;
 	self->iteratorQueue[self->currentIteratorPair*2+1] = bodyIterator;
+	multipart_Generator_account(bodyIterator,&self->bufferedBytes);
+	if(self->spoolThreshold)
+	{
+		multipart_Generator_spoolAfter(bodyIterator,self->spoolThreshold,self->spoolDir);
+	}
 	
 	self->iteratorQueueLengthInPairs += 1;
 	
 	return true;
 }
   
-static int multipart_Parser_on_header_field(void * actor, const char * data, size_t length)
+static int multipart_Parser_on_part_data_begin(void * actor)
 {
-	
 	multipart_Parser * const self = actor;
 	
-	//Check for this being headers on a new part
-	if(self->headersComplete)
+	//Every part gets its iterators here, even one without headers
+	if(not queuePush(self))
 	{
-		if(not queuePush(self))
-		{
-			return 1;
-		}
-		self->headersComplete = false;
+		return 1;
+	}
+	releaseFinishedPairs(self);
+	self->headersComplete = false;
+	
+	if(self->digestKinds)
+	{
+		multipart_digest_init(&self->digest,self->digestKinds);
 	}
+	multipart_decoder_init(&self->decoder,MULTIPART_ENCODING_IDENTITY);
 	
-	//Calculate the required size after adding the new data
-	const int requiredSize = length + self->headerFieldLength + 1;
+	return 0;
+}
+
+//Appends a span of header bytes to the arena, doubling it when full
+static bool appendHeaderBytes(multipart_Parser * const self, const char * data, size_t length)
+{
+	const size_t requiredSize = self->headerArenaLength + length;
 	
-	//Reallocate memory if neccessary
-	if(requiredSize > self->headerFieldSize)
+	if(requiredSize > self->headerArenaSize)
 	{
-		void * const newMem = PyMem_Realloc(self->headerFieldInProgress,requiredSize);
+		size_t newSize = self->headerArenaSize * 2;
+		while(newSize < requiredSize)
+		{
+			newSize *= 2;
+		}
+		
+		void * const newMem = PyMem_Realloc(self->headerArena,newSize);
 		if(not newMem)
 		{
-			//Return -1 to indicate failure in callback to the parser.
-			return -1;
+			PyErr_NoMemory();
+			return false;
 		}
-		self->headerFieldInProgress = newMem;
-		self->headerFieldSize = requiredSize;
+		self->headerArena = newMem;
+		self->headerArenaSize = newSize;
+	}
+	
+	memcpy(self->headerArena + self->headerArenaLength,data,length);
+	self->headerArenaLength += length;
+	return true;
+}
+
+static int multipart_Parser_on_header_field(void * actor, const char * data, size_t length)
+{
+	multipart_Parser * const self = actor;
+	
+	//Fragments of a field follow each other in the arena
+	if(self->headerFieldLength == 0)
+	{
+		self->headerFieldOffset = self->headerArenaLength;
 	}
 	
-	//Copy the memory onto the field and update the length;
-	memcpy(self->headerFieldInProgress + self->headerFieldLength, data,length);
+	if(not appendHeaderBytes(self,data,length))
+	{
+		return 1;
+	}
 	self->headerFieldLength += length;
 	return 0;
 }
 
 static int multipart_Parser_on_header_value(void * actor, const char * data, size_t length)
 {
+	multipart_Parser * const self = actor;
+	
+	if(self->headerValueLength == 0)
+	{
+		self->headerValueOffset = self->headerArenaLength;
+	}
+	
+	if(not appendHeaderBytes(self,data,length))
+	{
+		return 1;
+	}
+	self->headerValueLength += length;
+	return 0;
+}
 
+static bool pushData(multipart_Parser * const self, const char * data, size_t length)
+{
+	PyObject * const generator = self->iteratorQueue[self->currentIteratorPair*2+1];
 	
-	multipart_Parser * const self = actor;
+	//Data for a part that is already far behind goes to disk as is
+	const int spooled = multipart_Generator_spool(generator,data,length);
+	if(spooled != 0)
+	{
+		return spooled > 0;
+	}
 	
-	//Append this to the existing buffer, enlarging the buffer 
-	//if need be
-	const int requiredSize = length + self->headerValueLength + 1;
+	PyObject * bytes;
 	
-	if(requiredSize > self->headerValueSize)
+	//Spans that lie inside the input chunk can reference it directly.
+	//Anything else, like the parser's lookbehind, has to be copied.
+	if(self->zeroCopy and self->input and data >= self->inputData and data + length <= self->inputData + self->inputLength)
 	{
-		void * const newMem = PyMem_Realloc(self->headerValueInProgress,requiredSize);
-		if(not newMem)
+		bytes = PyBuffer_FromObject(self->input,(Py_ssize_t)(data - self->inputData),(Py_ssize_t)length);
+	}
+	else
+	{
+		bytes = PyString_FromStringAndSize(data,(Py_ssize_t)length);
+	}
+	
+	if(not bytes)
+	{
+		return false;
+	}
+	
+	//Hand the chunk to the generator which is the current destination
+	//for data
+	if(not multipart_Generator_push(generator,bytes))
+	{
+		return false;
+	}
+	
+	//Rather than buffering the rest of the chunk, the parser stops here
+	//until more data is asked for
+	if(self->maxBuffer and self->bufferedBytes >= self->maxBuffer)
+	{
+		multipart_parser_pause(self->parser);
+	}
+	
+	return true;
+}
+
+//Writes the buffers out completely with the GIL released
+static bool writeAll(int const fd, struct iovec * iov, int count)
+{
+	while(count > 0)
+	{
+		ssize_t result;
+		Py_BEGIN_ALLOW_THREADS
+		result = writev(fd,iov,count);
+		Py_END_ALLOW_THREADS
+		
+		if(result < 0)
 		{
-			return -1;
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			PyErr_SetFromErrno(PyExc_IOError);
+			return false;
 		}
 		
-		self->headerValueInProgress = newMem;
-		self->headerValueSize = requiredSize;
+		//Skip whatever was written, which may end inside a buffer
+		while(count > 0 and (size_t)result >= iov->iov_len)
+		{
+			result -= iov->iov_len;
+			iov += 1;
+			count -= 1;
+		}
+		if(count > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + result;
+			iov->iov_len -= result;
+		}
 	}
 	
-	memcpy(self->headerValueInProgress + self->headerValueLength, data, length);
-	self->headerValueLength += length;
-	return 0;
+	return true;
 }
 
-static int multipart_Parser_on_part_data(void * actor , const char * data, size_t length)
+//Writes a span of part data to the sink descriptor. Spans outside the
+//input chunk are only copied into sinkCarry, since they are followed by
+//a span of the chunk or the end of the chunk.
+static bool sinkData(multipart_Parser * const self, const char * data, size_t length)
 {
+	const bool inInput = self->input and data >= self->inputData and data + length <= self->inputData + self->inputLength;
 	
+	if(not inInput)
+	{
+		const size_t requiredSize = self->sinkCarryLength + length;
+		
+		if(requiredSize > self->sinkCarrySize)
+		{
+			void * const newMem = PyMem_Realloc(self->sinkCarry,requiredSize);
+			if(not newMem)
+			{
+				PyErr_NoMemory();
+				return false;
+			}
+			self->sinkCarry = newMem;
+			self->sinkCarrySize = requiredSize;
+		}
+		
+		memcpy(self->sinkCarry + self->sinkCarryLength,data,length);
+		self->sinkCarryLength += length;
+		return true;
+	}
 	
-	multipart_Parser * const self = actor;
+	struct iovec iov[2];
+	int count = 0;
 	
-	PyObject * const bytes = PyString_FromStringAndSize(data,(Py_ssize_t)length);
+	if(self->sinkCarryLength)
+	{
+		iov[count].iov_base = self->sinkCarry;
+		iov[count].iov_len = self->sinkCarryLength;
+		count += 1;
+	}
+	iov[count].iov_base = (char*)data;
+	iov[count].iov_len = length;
+	count += 1;
 	
-	if(not bytes)
+	self->sinkCarryLength = 0;
+	return writeAll(self->sinkFd,iov,count);
+}
+
+static bool flushSink(multipart_Parser * const self)
+{
+	if(self->sinkFd == -1 or self->sinkCarryLength == 0)
 	{
-		PyErr_NoMemory();
-		return 1;
+		return true;
 	}
 	
-	//Pack into a tuple
-	PyObject * const tuple = PyTuple_Pack(1,bytes);
-	Py_DECREF(bytes);
+	struct iovec iov = { self->sinkCarry, self->sinkCarryLength };
+	self->sinkCarryLength = 0;
+	return writeAll(self->sinkFd,&iov,1);
+}
+
+static bool flushPendingData(multipart_Parser * const self)
+{
+	if(self->pendingLength == 0)
+	{
+		return true;
+	}
 	
-	if(not tuple)
+	const size_t length = self->pendingLength;
+	self->pendingLength = 0;
+	return pushData(self,self->pendingData,length);
+}
+
+//Passes a span of the part's data, decoded if need be, on to wherever
+//the part's data goes
+static int takeData(multipart_Parser * const self, const char * data, size_t length)
+{
+	//Every byte counts towards the digests, wherever it goes next
+	if(self->digestKinds)
 	{
-		PyErr_NoMemory();
-		return 1;
+		multipart_digest_update(&self->digest,data,length);
 	}
 	
-	//Get the push method of the generator which is the current destination
-	//for headers
-	PyObject * const push = PyObject_GetAttrString(self->iteratorQueue[self->currentIteratorPair*2+1],"push");
+	if(self->sinkFd != -1)
+	{
+		return sinkData(self,data,length) ? 0 : 1;
+	}
 	
-	if(not push)
+	if(currentDataAbandoned(self))
 	{
-		PyErr_SetString(PyExc_NameError,"Cannot find Generator.push");
-		Py_DECREF(tuple);
-		return 1;
+		return 0;
+	}
+	
+	//Large spans go straight through, small ones are gathered until
+	//they add up to minChunk
+	if(self->pendingLength == 0 and length >= self->minChunk)
+	{
+		return pushData(self,data,length) ? 0 : 1;
 	}
 	
-	//Pass the tuple object to the generator
-	PyObject * const result = PyObject_Call(push,tuple,NULL);
-	Py_DECREF(tuple);
-	Py_DECREF(push);
+	const size_t requiredSize = self->pendingLength + length;
 	
-	if(not result)
+	if(requiredSize > self->pendingSize)
 	{
-		return 1;
+		void * const newMem = PyMem_Realloc(self->pendingData,requiredSize);
+		if(not newMem)
+		{
+			PyErr_NoMemory();
+			return 1;
+		}
+		self->pendingData = newMem;
+		self->pendingSize = requiredSize;
 	}
 	
-	Py_DECREF(result);
+	memcpy(self->pendingData + self->pendingLength,data,length);
+	self->pendingLength += length;
+	
+	if(self->pendingLength >= self->minChunk)
+	{
+		return flushPendingData(self) ? 0 : 1;
+	}
 	
 	return 0;
 }
 
+static int multipart_Parser_on_part_data(void * actor , const char * data, size_t length)
+{
+	multipart_Parser * const self = actor;
+	
+	if(self->decoder.encoding == MULTIPART_ENCODING_IDENTITY)
+	{
+		return takeData(self,data,length);
+	}
+	
+	//Decoded bytes go on like a span from outside the input chunk
+	const size_t requiredSize = multipart_decoder_bound(&self->decoder,length);
+	
+	if(requiredSize > self->decodedSize)
+	{
+		void * const newMem = PyMem_Realloc(self->decoded,requiredSize);
+		if(not newMem)
+		{
+			PyErr_NoMemory();
+			return 1;
+		}
+		self->decoded = newMem;
+		self->decodedSize = requiredSize;
+	}
+	
+	const size_t decodedLength = multipart_decoder_update(&self->decoder,data,length,self->decoded);
+	return decodedLength ? takeData(self,self->decoded,decodedLength) : 0;
+}
+
 static int multipart_Parser_on_header_value_end(void * actor)
 {
 	
 	multipart_Parser * const self = actor;
 	
-	//Null terminate both buffers
-	self->headerFieldInProgress[self->headerFieldLength] = '\0';
-	self->headerValueInProgress[self->headerValueLength] = '\0';
+	char const * const fieldData = self->headerArena + self->headerFieldOffset;
+	char const * const valueData = self->headerArena + self->headerValueOffset;
+	
+	static const char ENCODING[] = "Content-Transfer-Encoding";
+	if(self->decode and self->headerFieldLength == sizeof(ENCODING) - 1 and
+	   strncasecmp(fieldData,ENCODING,sizeof(ENCODING) - 1) == 0)
+	{
+		multipart_decoder_init(&self->decoder,multipart_encoding_from_name(valueData,self->headerValueLength));
+	}
+	
+	if(self->structuredHeaders)
+	{
+		if(not multipart_Headers_add(self->iteratorQueue[self->currentIteratorPair*2],
+		                             fieldData,self->headerFieldLength,
+		                             valueData,self->headerValueLength))
+		{
+			return 1;
+		}
+		
+		self->headerValueLength = 0;
+		self->headerFieldLength = 0;
+		return 0;
+	}
 	
 	//Construct two string objects, one for the field and one
 	//for the value
-	PyObject * const field = PyString_FromString(self->headerFieldInProgress);
-	PyObject * const value = PyString_FromString(self->headerValueInProgress);
+	PyObject * const field = PyString_FromStringAndSize(fieldData,self->headerFieldLength);
+	PyObject * const value = PyString_FromStringAndSize(valueData,self->headerValueLength);
 	
 	if(not value or not field)
 	{
@@ -326,29 +738,30 @@ static int multipart_Parser_on_header_value_end(void * actor)
 		return 1;
 	}
 	
-	//Get the push method of the generator which is the current destination
-	//for headers
-	PyObject * const push = PyObject_GetAttrString(self->iteratorQueue[self->currentIteratorPair*2],"push");
-	
-	if(not push)
+	//The sink gets to see all of the headers of the part
+	if(self->partHeaders and PyList_Append(self->partHeaders,tuple) == -1)
 	{
-		PyErr_SetString(PyExc_NameError,"Cannot find Generator.push");
 		Py_DECREF(tuple);
 		return 1;
 	}
 	
-	//Pass the tuple object to the generator
-	PyObject * const result = PyObject_Call(push,tuple,NULL);
-	Py_DECREF(tuple);
-	Py_DECREF(push);
-	
-	if(not result)
+	if(self->parts)
+	{
+		const int appended = PyList_Append(self->iteratorQueue[self->currentIteratorPair*2],tuple);
+		Py_DECREF(tuple);
+		
+		if(appended == -1)
+		{
+			return 1;
+		}
+	}
+	//Pass the tuple to the generator which is the current destination
+	//for headers
+	else if(not multipart_Generator_push(self->iteratorQueue[self->currentIteratorPair*2],tuple))
 	{
 		return 1;
 	}
 	
-	Py_DECREF(result);
-	
 	//This header is now complete. The length of the buffers is now
 	//zero'd.
 	self->headerValueLength = 0;
@@ -356,97 +769,192 @@ static int multipart_Parser_on_header_value_end(void * actor)
 	return 0;
 }
 
-static int multipart_Parser_on_headers_complete(void * actor)
+//Asks the sink where the data of the current part should go
+static bool openSink(multipart_Parser * const self)
 {
+	PyObject * headers;
 	
-	multipart_Parser * const self = actor;
-	self->headersComplete = true;
+	if(self->structuredHeaders)
+	{
+		headers = self->iteratorQueue[self->currentIteratorPair*2];
+		Py_INCREF(headers);
+	}
+	else
+	{
+		headers = self->partHeaders;
+		self->partHeaders = PyList_New(0);
+		
+		if(not self->partHeaders)
+		{
+			Py_DECREF(headers);
+			return false;
+		}
+	}
 	
-	//Get the done method from the current header generator
-	PyObject * const done = PyObject_GetAttrString(self->iteratorQueue[self->currentIteratorPair*2],"done");
+	PyObject * const target = PyObject_CallFunctionObjArgs(self->sink,headers,NULL);
+	Py_DECREF(headers);
 	
-	if(not done)
+	if(not target)
 	{
-		PyErr_SetString(PyExc_NameError,"Cannot find Generator.done");
-		return 1;
+		return false;
 	}
 	
-	//Signal to the header generator that no more 
-	//headers are coming
-	PyObject * const emptyTuple = PyTuple_Pack(0);
-	
-	if(not emptyTuple)
+	if(target == Py_None)
 	{
-		PyErr_NoMemory();
-		return 1;
+		Py_DECREF(target);
+		return true;
 	}
 	
-	PyObject * const result = PyObject_Call(done,emptyTuple,NULL);
-	Py_DECREF(done);
-	Py_DECREF(emptyTuple);
+	const int fd = PyObject_AsFileDescriptor(target);
 	
-	if(not result)
+	if(fd == -1)
 	{
-		return 1;
+		Py_DECREF(target);
+		return false;
 	}
-	Py_DECREF(result);
 	
-	return 0;
+	//The target is kept until the part ends, so a file object returned
+	//by the sink is not closed under the parser
+	self->sinkTarget = target;
+	self->sinkFd = fd;
+	return true;
 }
 
-static int multipart_Parser_on_part_data_end(void * actor)
+static int multipart_Parser_on_headers_complete(void * actor)
 {
+	
 	multipart_Parser * const self = actor;
-
+	self->headersComplete = true;
 	
-	//Get the done method from the current data generator
-	PyObject * const done = PyObject_GetAttrString(self->iteratorQueue[self->currentIteratorPair*2+1],"done");
+	//Every header of the part has been turned into objects by now
+	self->headerArenaLength = 0;
 	
-	if(not done)
+	PyObject * const headers = self->iteratorQueue[self->currentIteratorPair*2];
+	
+	if(self->structuredHeaders)
 	{
-		PyErr_SetString(PyExc_NameError,"Cannot find Generator.done");
-		return 1;
+		if(not multipart_Headers_complete(headers))
+		{
+			return 1;
+		}
 	}
-	
-	//Signal to the header generator that no more 
-	//headers are coming
-	PyObject * const emptyTuple = PyTuple_Pack(0);
-	
-	if(not emptyTuple)
+	else if(not self->parts)
 	{
-		PyErr_NoMemory();
-		return 1;
+		//Signal to the header generator that no more 
+		//headers are coming
+		multipart_Generator_done(headers);
 	}
 	
-	PyObject * const result = PyObject_Call(done,emptyTuple,NULL);
-	Py_DECREF(done);
-	Py_DECREF(emptyTuple);
-	
-	if(not result)
+	if(self->sink)
 	{
-		return 1;
+		return openSink(self) ? 0 : 1;
 	}
-	Py_DECREF(result);
 	
 	return 0;
 }
 
-static int multipart_Parser_on_body_end(void * actor)
+//Builds a dict mapping the name of each digest of the current part to
+//its hex digest
+static PyObject * digestDict(multipart_Parser * const self)
 {
-	multipart_Parser * const self = actor;
-	self->dataComplete = true;
+	static const char HEX[] = "0123456789abcdef";
+	PyObject * const digests = PyDict_New();
 	
-	return 0;
+	for(unsigned kind = 1; digests and kind <= self->digestKinds; kind <<= 1)
+	{
+		if(not (self->digestKinds & kind))
+		{
+			continue;
+		}
+		
+		unsigned char raw[MULTIPART_DIGEST_MAX_SIZE];
+		char hex[2*MULTIPART_DIGEST_MAX_SIZE];
+		const size_t length = multipart_digest_final(&self->digest,kind,raw);
+		
+		for(size_t i = 0; i < length; i++)
+		{
+			hex[2*i] = HEX[raw[i] >> 4];
+			hex[2*i+1] = HEX[raw[i] & 15];
+		}
+		
+		PyObject * const value = PyString_FromStringAndSize(hex,2*length);
+		if(not value or PyDict_SetItemString(digests,multipart_digest_name(kind),value) != 0)
+		{
+			Py_XDECREF(value);
+			Py_DECREF(digests);
+			return NULL;
+		}
+		Py_DECREF(value);
+	}
+	
+	return digests;
 }
 
-static multipart_parser_settings callbackRegistry = 
+static int multipart_Parser_on_part_data_end(void * actor)
+{
+	multipart_Parser * const self = actor;
+	
+	//The end of the data completes a quantum that was cut short
+	char tail[3];
+	const size_t tailLength = multipart_decoder_finish(&self->decoder,tail);
+	if(tailLength and takeData(self,tail,tailLength) != 0)
+	{
+		return 1;
+	}
+
+	if(self->sinkFd != -1)
+	{
+		const bool flushed = flushSink(self);
+		self->sinkFd = -1;
+		Py_CLEAR(self->sinkTarget);
+		
+		if(not flushed)
+		{
+			return 1;
+		}
+	}
+	
+	if(not flushPendingData(self))
+	{
+		return 1;
+	}
+	
+	
+	PyObject * const dataGenerator = self->iteratorQueue[self->currentIteratorPair*2+1];
+	
+	if(self->digestKinds)
+	{
+		PyObject * const digests = digestDict(self);
+		if(not digests)
+		{
+			return 1;
+		}
+		multipart_Generator_setDigests(dataGenerator,digests);
+		Py_DECREF(digests);
+	}
+	
+	//Signal to the data generator that the part is over
+	multipart_Generator_done(dataGenerator);
+	
+	return 0;
+}
+
+static int multipart_Parser_on_body_end(void * actor)
+{
+	multipart_Parser * const self = actor;
+	self->dataComplete = true;
+	
+	return 0;
+}
+
+static multipart_parser_settings callbackRegistry = 
 {
   multipart_Parser_on_header_field, //multipart_data_cb on_header_field;
   multipart_Parser_on_header_value, //multipart_data_cb on_header_value;
   multipart_Parser_on_part_data, //multipart_data_cb on_part_data;
 
   multipart_Parser_on_header_value_end, //multipart_notify_cb on_header_value_end;
-  NULL, //multipart_notify_cb on_part_data_begin;
+  multipart_Parser_on_part_data_begin, //multipart_notify_cb on_part_data_begin;
   multipart_Parser_on_headers_complete, //multipart_notify_cb on_headers_complete;
   multipart_Parser_on_part_data_end, //multipart_notify_cb on_part_data_end;
   multipart_Parser_on_body_end //multipart_notify_cb on_body_end;
@@ -468,29 +976,238 @@ static bool allocateIteratorQueue(multipart_Parser * const self)
 	return true;
 }
 
+//Sets digestKinds from a sequence of digest names
+static bool parseDigestKinds(multipart_Parser * const self, PyObject * const digests)
+{
+	PyObject * const names = PySequence_Fast(digests,"digests must be a sequence of names");
+	if(not names)
+	{
+		return false;
+	}
+	
+	for(Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(names); i++)
+	{
+		char const * const name = PyString_AsString(PySequence_Fast_GET_ITEM(names,i));
+		const unsigned kind = name ? multipart_digest_from_name(name) : 0;
+		
+		if(not kind)
+		{
+			if(name)
+			{
+				PyErr_Format(PyExc_ValueError,"unknown digest '%s', expected md5, sha1, sha256 or crc32c",name);
+			}
+			Py_DECREF(names);
+			return false;
+		}
+		self->digestKinds |= kind;
+	}
+	
+	Py_DECREF(names);
+	return true;
+}
+
 static int Parser_init(multipart_Parser * const self, PyObject * args, PyObject * kwds)
 {
 
 	char const * boundary;
 	PyObject * fin;
-	static char * kwlist[] = {"boundary","fin",NULL};
-	if( not PyArg_ParseTupleAndKeywords(args,kwds,"sO",kwlist,&boundary,&fin) )
+	char const * search = "scan";
+	Py_ssize_t minChunk = 0;
+	PyObject * zeroCopy = NULL;
+	Py_ssize_t blockSize = 256*1024;
+	PyObject * contentLength = Py_None;
+	Py_ssize_t maxBuffer = 0;
+	Py_ssize_t spoolThreshold = 0;
+	PyObject * spoolDir = Py_None;
+	PyObject * sink = Py_None;
+	PyObject * releaseGil = Py_False;
+	PyObject * digests = Py_None;
+	PyObject * decode = Py_False;
+	PyObject * structuredHeaders = Py_False;
+	PyObject * parts = Py_False;
+	Py_ssize_t eagerThreshold = 0;
+	Py_ssize_t limits[5] = {0,0,0,0,0};
+	static char * kwlist[] = {"boundary","fin","search","min_chunk","zero_copy","block_size","content_length","max_buffer","spool_threshold","spool_dir","sink","release_gil","digests","decode","structured_headers","parts","eager_threshold",
+	                          "max_header_bytes","max_headers_per_part","max_parts","max_part_bytes","max_total_bytes",NULL};
+	if( not PyArg_ParseTupleAndKeywords(args,kwds,"sO|snOnOnnOOOOOOOnnnnnn",kwlist,&boundary,&fin,&search,&minChunk,&zeroCopy,&blockSize,&contentLength,&maxBuffer,&spoolThreshold,&spoolDir,&sink,&releaseGil,&digests,&decode,&structuredHeaders,&parts,&eagerThreshold,
+	                                    &limits[0],&limits[1],&limits[2],&limits[3],&limits[4]) )
+	{
+		return -1;
+	}
+	
+	if(not multipart_Parser_parseLimits(&self->limits,limits,kwlist + 17))
+	{
+		return -1;
+	}
+	
+	self->decode = PyObject_IsTrue(decode) == 1;
+	self->structuredHeaders = PyObject_IsTrue(structuredHeaders) == 1;
+	self->parts = PyObject_IsTrue(parts) == 1;
+	
+	if(eagerThreshold < 0)
+	{
+		PyErr_SetString(PyExc_ValueError,"eager_threshold must not be negative");
+		return -1;
+	}
+	
+	//Data written to a sink would not show up in the value
+	if(eagerThreshold and sink != Py_None)
+	{
+		PyErr_SetString(PyExc_ValueError,"eager_threshold cannot be combined with sink");
+		return -1;
+	}
+	
+	//The value of a small part is kept on the part, so parts are implied
+	self->eagerThreshold = eagerThreshold;
+	self->parts = self->parts or eagerThreshold != 0;
+	
+	if(digests != Py_None and not parseDigestKinds(self,digests))
+	{
+		return -1;
+	}
+	
+	self->releaseGil = PyObject_IsTrue(releaseGil) == 1;
+	
+	if(sink != Py_None)
+	{
+		if(not PyCallable_Check(sink))
+		{
+			PyErr_SetString(PyExc_TypeError,"sink must be callable");
+			return -1;
+		}
+		
+		self->partHeaders = PyList_New(0);
+		if(not self->partHeaders)
+		{
+			return -1;
+		}
+		self->sink = sink;
+		Py_INCREF(self->sink);
+	}
+	
+	if(spoolThreshold < 0)
+	{
+		PyErr_SetString(PyExc_ValueError,"spool_threshold must not be negative");
+		return -1;
+	}
+	
+	if(spoolDir != Py_None and not PyString_Check(spoolDir))
+	{
+		PyErr_SetString(PyExc_TypeError,"spool_dir must be a string or None");
+		return -1;
+	}
+	self->spoolThreshold = spoolThreshold;
+	self->spoolDir = spoolDir;
+	Py_INCREF(self->spoolDir);
+	
+	if(maxBuffer < 0)
+	{
+		PyErr_SetString(PyExc_ValueError,"max_buffer must not be negative");
+		return -1;
+	}
+	self->maxBuffer = maxBuffer;
+	
+	//Events recorded without the GIL are replayed for a whole chunk, so
+	//the cap could not hold
+	if(self->maxBuffer and self->releaseGil)
 	{
+		PyErr_SetString(PyExc_ValueError,"max_buffer cannot be combined with release_gil");
 		return -1;
 	}
 	
-	//Extract from the file input argument a method which can be used
-	//as an iterator
-	self->readIterator = PyObject_GetIter(fin);
+	if(contentLength != Py_None)
+	{
+		self->remaining = PyNumber_AsSsize_t(contentLength,PyExc_OverflowError);
+		
+		if(self->remaining == -1 and PyErr_Occurred())
+		{
+			return -1;
+		}
+		
+		if(self->remaining < 0)
+		{
+			PyErr_SetString(PyExc_ValueError,"content_length must not be negative");
+			return -1;
+		}
+	}
 	
-	if(not self->readIterator) 
+	if(blockSize < 0)
 	{
-		PyErr_SetString(PyExc_AttributeError,"fin must be iterable");
+		PyErr_SetString(PyExc_ValueError,"block_size must not be negative");
 		return -1;
 	}
+	self->blockSize = blockSize;
+	
+	if(minChunk < 0)
+	{
+		PyErr_SetString(PyExc_ValueError,"min_chunk must not be negative");
+		return -1;
+	}
+	self->minChunk = minChunk;
+	
+	//Choose how the body of each part is searched for the boundary
+	enum multipart_search searchMode;
+	if(0 == strcmp(search,"scan"))
+	{
+		searchMode = MULTIPART_SEARCH_SCAN;
+	}
+	else if(0 == strcmp(search,"horspool"))
+	{
+		searchMode = MULTIPART_SEARCH_HORSPOOL;
+	}
+	else
+	{
+		PyErr_SetString(PyExc_ValueError,"search must be 'scan' or 'horspool'");
+		return -1;
+	}
+	
+	//File-like objects are read in blocks of blockSize bytes, so the
+	//number of chunks does not depend on where newlines fall.
+	//A block size of zero always iterates fin.
+	if(PyObject_CheckReadBuffer(fin) and not PyUnicode_Check(fin))
+	{
+		self->readMode = READ_MAPPED;
+		Py_INCREF(fin);
+		self->mapping = fin;
+	}
+	else if(self->blockSize > 0 and PyObject_HasAttrString(fin,"readinto"))
+	{
+		self->readMode = READ_READINTO;
+		self->readMethod = PyObject_GetAttrString(fin,"readinto");
+	}
+	else if(self->blockSize > 0 and PyObject_HasAttrString(fin,"read"))
+	{
+		self->readMode = READ_READ;
+		self->readMethod = PyObject_GetAttrString(fin,"read");
+	}
 	
-	//Construct the parser with the provided boundary
-	self->parser = multipart_parser_init(boundary,&callbackRegistry);
+	if(self->readMode == READ_READ or self->readMode == READ_READINTO)
+	{
+		if(not self->readMethod)
+		{
+			return -1;
+		}
+	}
+	else if(self->readMode == READ_ITERATE)
+	{
+		//Extract from the file input argument a method which can be used
+		//as an iterator
+		self->readIterator = PyObject_GetIter(fin);
+		
+		if(not self->readIterator) 
+		{
+			PyErr_SetString(PyExc_AttributeError,"fin must be iterable");
+			return -1;
+		}
+	}
+	
+	//Part data of a mapped body, other than a string, is handed out as
+	//views of it unless asked otherwise
+	self->zeroCopy = zeroCopy ? PyObject_IsTrue(zeroCopy) == 1 : self->readMode == READ_MAPPED and not PyString_Check(fin);
+	
+	//Construct the parser with the provided boundary. Without the GIL
+	//it can only record what it finds.
+	self->parser = multipart_parser_init(boundary,self->releaseGil ? &multipart_events_settings : &callbackRegistry);
 	if( not self->parser )
 	{
 		PyErr_SetString(PyExc_MemoryError,"multipart_parser_init returned NULL");
@@ -499,7 +1216,11 @@ static int Parser_init(multipart_Parser * const self, PyObject * args, PyObject
 	
 	//Pass the parser a pointer to this object. It passes it back as a
 	//the first argument to all the callbacks 
-	multipart_parser_set_data(self->parser,(void*)self);
+	multipart_parser_set_data(self->parser,self->releaseGil ? (void*)&self->events : (void*)self);
+	multipart_parser_set_search(self->parser,searchMode);
+	//Any minimum chunk size asks for spans that are not split at each CR
+	multipart_parser_set_coalesce(self->parser,self->minChunk > 0);
+	multipart_parser_set_limits(self->parser,&self->limits);
 	
 	//Build the queue used for the iterators
 	if(not allocateIteratorQueue(self))
@@ -517,16 +1238,151 @@ static PyObject* Parser_iter(PyObject * self)
 	return self;
 }
 
-static PyObject* Parser_read(multipart_Parser * const self, PyObject * unused0, PyObject * unused1)
+//Fills readBuffer from fin.readinto and returns it, or NULL at the end
+//of the input or on error.
+static PyObject * readIntoBuffer(multipart_Parser * const self)
 {
-	//Retrieve bytes from the underlying data stream.
-	//In this case, an iterator
-	PyObject * const i = PyIter_Next(self->readIterator);
+	//The buffer can only be refilled if no zero copy chunk still
+	//references it
+	if(self->readBuffer and Py_REFCNT(self->readBuffer) > 1)
+	{
+		Py_CLEAR(self->readBuffer);
+	}
+	
+	if(not self->readBuffer)
+	{
+		self->readBuffer = PyByteArray_FromStringAndSize(NULL,(Py_ssize_t)self->blockSize);
+		
+		if(not self->readBuffer)
+		{
+			return NULL;
+		}
+	}
+	
+	//Near the end of a body of known length only part of the buffer
+	//is offered to readinto
+	PyObject * target = self->readBuffer;
+	Py_INCREF(target);
+	
+	if(self->remaining >= 0 and self->remaining < (Py_ssize_t)self->blockSize)
+	{
+		PyObject * const view = PyMemoryView_FromObject(self->readBuffer);
+		Py_DECREF(target);
+		target = view ? PySequence_GetSlice(view,0,self->remaining) : NULL;
+		Py_XDECREF(view);
+		
+		if(not target)
+		{
+			return NULL;
+		}
+	}
+	
+	PyObject * const result = PyObject_CallFunctionObjArgs(self->readMethod,target,NULL);
+	Py_DECREF(target);
+	
+	if(not result)
+	{
+		return NULL;
+	}
+	
+	//readinto returns the number of bytes read, zero or None at the end
+	const Py_ssize_t count = (result == Py_None) ? 0 : PyNumber_AsSsize_t(result,PyExc_OverflowError);
+	Py_DECREF(result);
+	
+	if(count == -1 and PyErr_Occurred())
+	{
+		return NULL;
+	}
+	
+	if(count < 0 or count > (Py_ssize_t)self->blockSize)
+	{
+		PyErr_SetString(PyExc_ValueError,"readinto returned an invalid length");
+		return NULL;
+	}
+	
+	if(count == 0)
+	{
+		return NULL;
+	}
+	
+	//A short read is passed on as is. The bytearray is not resized, the
+	//parser is just given fewer bytes.
+	self->inputLength = count;
+	Py_INCREF(self->readBuffer);
+	return self->readBuffer;
+}
+
+//Retrieves the next chunk of input from fin and stores its raw bytes in
+//inputData and inputLength. Returns NULL at the end of the input or on
+//error.
+static PyObject * nextInput(multipart_Parser * const self)
+{
+	if(self->remaining == 0)
+	{
+		return NULL;
+	}
+	
+	if(self->readMode == READ_MAPPED)
+	{
+		//The whole mapping is one chunk
+		void const * data;
+		Py_ssize_t length;
+		
+		if(PyObject_AsReadBuffer(self->mapping,&data,&length) != 0)
+		{
+			return NULL;
+		}
+		
+		if(self->remaining >= 0 and self->remaining < length)
+		{
+			length = self->remaining;
+		}
+		self->remaining = 0;
+		
+		self->inputData = data;
+		self->inputLength = length;
+		Py_INCREF(self->mapping);
+		return self->mapping;
+	}
+	
+	if(self->readMode == READ_READINTO)
+	{
+		PyObject * const buffer = readIntoBuffer(self);
+		
+		if(buffer)
+		{
+			self->inputData = PyByteArray_AS_STRING(buffer);
+			
+			if(self->remaining > 0)
+			{
+				self->remaining -= self->inputLength;
+			}
+		}
+		return buffer;
+	}
+	
+	PyObject * i;
 	
-	//If the iterator returns NULL, then no more data is available.
+	if(self->readMode == READ_READ)
+	{
+		Py_ssize_t size = self->blockSize;
+		
+		if(self->remaining >= 0 and self->remaining < size)
+		{
+			size = self->remaining;
+		}
+		i = PyObject_CallFunction(self->readMethod,"n",size);
+	}
+	else
+	{
+		//In this case, an iterator
+		i = PyIter_Next(self->readIterator);
+	}
+	
+	//If nothing is returned, then no more data is available.
 	if(i == NULL)
 	{
-		Py_RETURN_NONE;
+		return NULL;
 	}
 	
 	//Treat the returned object as just bytes
@@ -541,7 +1397,7 @@ static PyObject* Parser_read(multipart_Parser * const self, PyObject * unused0,
 	}
 	
 	//Extract from the bytes the raw data
-	char const * raw;
+	char * raw;
 	Py_ssize_t length;
 	
 	if(-1==PyString_AsStringAndSize(bytes,&raw,&length))
@@ -550,16 +1406,264 @@ static PyObject* Parser_read(multipart_Parser * const self, PyObject * unused0,
 		Py_DECREF(bytes);
 		return NULL;
 	}
+	
+	//read returns an empty string at the end of the input
+	if(self->readMode == READ_READ and length == 0)
+	{
+		Py_DECREF(bytes);
+		return NULL;
+	}
+	
+	if(self->readMode == READ_READ and self->remaining > 0)
+	{
+		self->remaining -= length < self->remaining ? length : self->remaining;
+	}
+	
+	self->inputData = raw;
+	self->inputLength = length;
+	return bytes;
+}
+
+//Feeds the recorded events to the callbacks, in the order the C parser
+//produced them
+static bool replayEvents(multipart_Parser * const self)
+{
+	multipart_events * const events = &self->events;
+	
+	for(size_t i = 0; i < events->length; i++)
+	{
+		const multipart_event * const event = &events->events[i];
+		const char * const at = multipart_event_data(events,event);
+		int result = 0;
+		
+		switch(event->type)
+		{
+			case MULTIPART_EVENT_HEADER_FIELD:
+				result = callbackRegistry.on_header_field(self,at,event->length);
+				break;
+			case MULTIPART_EVENT_HEADER_VALUE:
+				result = callbackRegistry.on_header_value(self,at,event->length);
+				break;
+			case MULTIPART_EVENT_PART_DATA:
+				result = callbackRegistry.on_part_data(self,at,event->length);
+				break;
+			case MULTIPART_EVENT_HEADER_VALUE_END:
+				result = callbackRegistry.on_header_value_end(self);
+				break;
+			case MULTIPART_EVENT_PART_DATA_BEGIN:
+				result = callbackRegistry.on_part_data_begin(self);
+				break;
+			case MULTIPART_EVENT_HEADERS_COMPLETE:
+				result = callbackRegistry.on_headers_complete(self);
+				break;
+			case MULTIPART_EVENT_PART_DATA_END:
+				result = callbackRegistry.on_part_data_end(self);
+				break;
+			case MULTIPART_EVENT_BODY_END:
+				result = callbackRegistry.on_body_end(self);
+				break;
+		}
+		
+		if(result != 0)
+		{
+			if(not PyErr_Occurred())
+			{
+				PyErr_NoMemory();
+			}
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+//Runs the C parser over one chunk and returns the number of bytes it
+//parsed. If a callback failed, an exception is set.
+static size_t executeChunk(multipart_Parser * const self, char const * const raw, size_t const length)
+{
+	if(not self->releaseGil)
+	{
+		return multipart_parser_execute(self->parser,raw,length);
+	}
+	
+	multipart_events_reset(&self->events,raw,length);
+	
+	size_t result;
+	Py_BEGIN_ALLOW_THREADS
+	result = multipart_parser_execute(self->parser,raw,length);
+	Py_END_ALLOW_THREADS
+	
+	if(self->events.failed)
+	{
+		PyErr_NoMemory();
+		return 0;
+	}
+	
+	//Whatever was parsed before an error is still delivered
+	if(not replayEvents(self))
+	{
+		return 0;
+	}
+	
+	return result;
+}
+
+//Reads one chunk of input and parses it. Returns false with an
+//exception set on failure.
+static size_t limitValue(const multipart_parser_limits * const limits, enum multipart_limit const limit)
+{
+	switch(limit)
+	{
+		case MULTIPART_LIMIT_HEADER_BYTES: return limits->max_header_bytes;
+		case MULTIPART_LIMIT_HEADERS_PER_PART: return limits->max_headers_per_part;
+		case MULTIPART_LIMIT_PARTS: return limits->max_parts;
+		case MULTIPART_LIMIT_PART_BYTES: return limits->max_part_bytes;
+		case MULTIPART_LIMIT_TOTAL_BYTES: return limits->max_total_bytes;
+		default: return 0;
+	}
+}
+
+void multipart_Parser_raiseLimitError(const multipart_parser_limits * const limits, enum multipart_limit const limit, size_t const offset)
+{
+	const char * const name = multipart_limit_name(limit);
+	PyObject * const error = PyObject_CallFunction(multipart_LimitError,"N",
+		PyString_FromFormat("%s of %zu exceeded at byte %zu",name,limitValue(limits,limit),offset));
+	
+	if(not error)
+	{
+		return;
+	}
+	
+	PyObject * const position = PyInt_FromSize_t(offset);
+	PyObject * const option = PyString_FromString(name);
+	
+	if(position and option and PyObject_SetAttrString(error,"offset",position) == 0 and
+	   PyObject_SetAttrString(error,"limit",option) == 0)
+	{
+		PyErr_SetObject(multipart_LimitError,error);
+	}
+	Py_XDECREF(position);
+	Py_XDECREF(option);
+	Py_DECREF(error);
+}
+
+bool multipart_Parser_parseLimits(multipart_parser_limits * const limits, const Py_ssize_t * const values, char * const * const names)
+{
+	for(size_t i = 0; i < 5; i++)
+	{
+		if(values[i] < 0)
+		{
+			PyErr_Format(PyExc_ValueError,"%s must not be negative",names[i]);
+			return false;
+		}
+	}
+	
+	limits->max_header_bytes = values[0];
+	limits->max_headers_per_part = values[1];
+	limits->max_parts = values[2];
+	limits->max_part_bytes = values[3];
+	limits->max_total_bytes = values[4];
+	return true;
+}
+
+static bool Parser_pull(PyObject * const object)
+{
+	multipart_Parser * const self = (multipart_Parser*)object;
+	
+	if(self->parsing)
+	{
+		PyErr_SetString(PyExc_RuntimeError,"Parser is already parsing a chunk");
+		return false;
+	}
+	
+	//Whoever asks for more input here is not reading the data that is
+	//already queued, so pulling more would only buffer it
+	if(self->maxBuffer and self->bufferedBytes >= self->maxBuffer)
+	{
+		PyErr_Format(PyExc_BufferError,
+		             "%zu bytes of part data are waiting to be read, max_buffer is %zu; read each part's data before moving on",
+		             self->bufferedBytes,self->maxBuffer);
+		return false;
+	}
+	
+	//Retrieve bytes from the underlying data stream, unless the parser
+	//paused in the last chunk
+	PyObject * bytes;
+	size_t offset = 0;
+	
+	if(self->pausedInput)
+	{
+		bytes = self->pausedInput;
+		offset = self->pausedOffset;
+		self->pausedInput = NULL;
+	}
+	else
+	{
+		bytes = nextInput(self);
+	}
+	
+	if(not bytes)
+	{
+		if(PyErr_Occurred())
+		{
+			return false;
+		}
+		
+		//Running out of input before the closing boundary would leave
+		//the iterators waiting forever
+		if(not self->dataComplete)
+		{
+			PyErr_SetString(PyExc_ValueError,"input ended before the closing boundary");
+			return false;
+		}
+		
+		return true;
+	}
+	
+	char const * const raw = self->inputData + offset;
+	const size_t length = self->inputLength - offset;
 
 	//Pass the raw data to the parser
-	const size_t result = multipart_parser_execute(self->parser,raw,length) ;
+	self->input = bytes;
+	self->parsing = true;
+	size_t result = executeChunk(self,raw,length);
+	self->parsing = false;
+	//Carried sink data has to be written before the chunk goes away
+	if(result == length and not flushSink(self))
+	{
+		result = 0;
+	}
+	self->input = NULL;
 	//Add the bytes parsed to the count
 	self->bytesParsed += result;
 	
+	//The rest of the chunk stays with the parser until it resumes
+	if(result < length and multipart_parser_paused(self->parser) and not PyErr_Occurred())
+	{
+		self->pausedInput = bytes;
+		self->pausedOffset = offset + result;
+		return true;
+	}
+	
 	//The parser returns the number of bytes parsed. It not all bytes
 	//are parsed, then an error occurred.
 	if( length != result )
 	{
+		//A callback that failed has already set the exception
+		if(PyErr_Occurred())
+		{
+			Py_DECREF(bytes);
+			return false;
+		}
+		
+		const enum multipart_limit limit = multipart_parser_limit_exceeded(self->parser);
+		if(limit != MULTIPART_LIMIT_NONE)
+		{
+			Py_DECREF(bytes);
+			multipart_Parser_raiseLimitError(&self->limits,limit,self->bytesParsed);
+			return false;
+		}
+		
 		char errmsg[64];
 		snprintf(errmsg,
 				 sizeof(errmsg),
@@ -569,39 +1673,25 @@ static PyObject* Parser_read(multipart_Parser * const self, PyObject * unused0,
 		
 		PyErr_SetString(PyExc_ValueError, errmsg);
 		Py_DECREF(bytes);
-		return NULL;
+		return false;
 	}
 	Py_DECREF(bytes);
 	
-	Py_RETURN_NONE;
+	return true;
 }
 
-static PyObject* Parser_iternext(multipart_Parser * const self)
-{	
-	//If there exists no more data then return immediately
-	if(self->dataComplete)
-	{
-		return NULL;
-	}
-
-	//Retrieve this objects read method
-	PyObject * const read = PyObject_GetAttrString((PyObject*)self,"read");
-	
-	if(not read)
-	{
-		PyErr_SetString(PyExc_NameError,"Could not find self.read");
-		return NULL;
-	}
-	
-	if(1!=PyCallable_Check(read))
+static PyObject* Parser_read(multipart_Parser * const self, PyObject * unused0, PyObject * unused1)
+{
+	if(not Parser_pull((PyObject*)self))
 	{
-		PyErr_SetString(PyExc_TypeError,"self.read is not callable");
 		return NULL;
 	}
 	
-	
-	PyObject * const emptyTuple = PyTuple_New(0);
-	
+	Py_RETURN_NONE;
+}
+
+static PyObject* Parser_iternext(multipart_Parser * const self)
+{	
 	//Check to see if the iterator pair being returned is getting ahead
 	//of the iterator pair being populated. This cannot be allowed
 	//to happen.
@@ -611,27 +1701,55 @@ static PyObject* Parser_iternext(multipart_Parser * const self)
 		//If there is no more data, then return immediately
 		if(self->dataComplete)
 		{
-			Py_DECREF(emptyTuple);
-			Py_DECREF(read);
+			releaseFinishedPairs(self);
 			return NULL;
 		}
 
-		//Call this objects read method. This does not return a 
-		//meaningful value (just None) but does update all of the internal
+		//Parse another chunk of input. This updates all of the internal
 		//values being checked here.
-		PyObject * const callresult = PyObject_Call(read,emptyTuple,NULL);
-		if(not callresult)
+		if(not Parser_pull((PyObject*)self))
 		{
-			Py_DECREF(emptyTuple);
-			Py_DECREF(read);
 			return NULL;
 		}
-		
-		Py_DECREF(callresult);
 	}
 	
-	Py_DECREF(read);
-	Py_DECREF(emptyTuple);
+	//A dict or list of headers is only handed out once it is complete
+	while((self->structuredHeaders or self->parts) and self->outgoingIteratorPair == self->currentIteratorPair and not self->headersComplete)
+	{
+		if(not Parser_pull((PyObject*)self))
+		{
+			return NULL;
+		}
+	}
+	
+	//A part already holds its headers
+	if(self->parts)
+	{
+		PyObject * const part = self->iteratorQueue[self->outgoingIteratorPair*2+1];
+		
+		//Small parts are completed before being handed out
+		while(self->eagerThreshold)
+		{
+			const int settled = multipart_Part_settle(part,self->eagerThreshold);
+			
+			if(settled == -1 or (settled == 0 and not Parser_pull((PyObject*)self)))
+			{
+				return NULL;
+			}
+			
+			if(settled == 1)
+			{
+				break;
+			}
+		}
+		
+		Py_INCREF(part);
+		
+		self->outgoingIteratorPair += 1;
+		releaseFinishedPairs(self);
+		
+		return part;
+	}
 	
 	//Build a tuple of the current set of iterators that should be exposed
 	//This tuple is of the form
@@ -645,11 +1763,92 @@ static PyObject* Parser_iternext(multipart_Parser * const self)
 	}
 	
 	self->outgoingIteratorPair += 1;
+	releaseFinishedPairs(self);
 	
 	return retval;
 }
 
-static PyMethodDef Parser_methods[] = { {"read",(PyCFunction)Parser_read, METH_KEYWORDS, "read from input source"},{NULL,NULL,0,NULL} };
+//Maps the file at path read-only and constructs a parser over the
+//mapping. Any further arguments are passed on to Parser.
+static PyObject* Parser_fromPath(PyObject * const cls, PyObject * const args, PyObject * const kwds)
+{
+	if(PyTuple_GET_SIZE(args) < 2)
+	{
+		PyErr_SetString(PyExc_TypeError,"from_path() takes a path and a boundary");
+		return NULL;
+	}
+	
+	char const * const path = PyString_AsString(PyTuple_GET_ITEM(args,0));
+	if(not path)
+	{
+		return NULL;
+	}
+	
+	const int fd = open(path,O_RDONLY);
+	if(fd < 0)
+	{
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+	}
+	
+	struct stat status;
+	if(fstat(fd,&status) != 0)
+	{
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+		close(fd);
+		return NULL;
+	}
+	
+	//An empty file cannot be mapped
+	PyObject * mapping;
+	if(status.st_size == 0)
+	{
+		mapping = PyString_FromStringAndSize(NULL,0);
+	}
+	else
+	{
+		PyObject * const mmapModule = PyImport_ImportModule("mmap");
+		mapping = mmapModule ? PyObject_CallMethod(mmapModule,"mmap","iiii",fd,0,MAP_SHARED,PROT_READ) : NULL;
+		Py_XDECREF(mmapModule);
+	}
+	//The mapping keeps its own descriptor
+	close(fd);
+	
+	if(not mapping)
+	{
+		return NULL;
+	}
+	
+	//The parser goes through the mapping once, front to back
+	void const * data;
+	Py_ssize_t length;
+	if(status.st_size > 0 and PyObject_AsReadBuffer(mapping,&data,&length) == 0)
+	{
+		madvise((void*)data,length,MADV_SEQUENTIAL);
+	}
+	PyErr_Clear();
+	
+	PyObject * const rest = PyTuple_GetSlice(args,2,PyTuple_GET_SIZE(args));
+	PyObject * const head = rest ? PyTuple_Pack(2,PyTuple_GET_ITEM(args,1),mapping) : NULL;
+	PyObject * const parserArgs = head ? PySequence_Concat(head,rest) : NULL;
+	Py_XDECREF(rest);
+	Py_XDECREF(head);
+	Py_DECREF(mapping);
+	
+	if(not parserArgs)
+	{
+		return NULL;
+	}
+	
+	PyObject * const parser = PyObject_Call(cls,parserArgs,kwds);
+	Py_DECREF(parserArgs);
+	return parser;
+}
+
+static PyMethodDef Parser_methods[] = {
+	{"read",(PyCFunction)Parser_read, METH_KEYWORDS, "read from input source"},
+	{"from_path",(PyCFunction)Parser_fromPath, METH_VARARGS | METH_KEYWORDS | METH_CLASS, "from_path(path, boundary, ...)\n\nParses the file at path through a read-only memory map, in one pass.\nPart data is returned as buffers into the mapping."},
+	{NULL,NULL,0,NULL}
+};
 static PyMemberDef Parser_members[] = { {NULL} };
 
 PyTypeObject multipart_ParserType = {
@@ -4,8 +4,23 @@
 #ifndef __multipart_Parser
 #define __multipart_Parser
 
+#include "stdbool.h"
+#include "multipart_parser.h"
 
 
 extern PyTypeObject multipart_ParserType;
 
+//multipart.LimitError, a ValueError raised when the input exceeds one of
+//the parser's limits
+extern PyObject * multipart_LimitError;
+
+//Raises LimitError for the limit hit at offset, with the option's name as
+//its limit attribute and offset as its offset attribute
+void multipart_Parser_raiseLimitError(const multipart_parser_limits * limits, enum multipart_limit limit, size_t offset);
+
+//Fills limits from the values of the max_header_bytes, max_headers_per_part,
+//max_parts, max_part_bytes and max_total_bytes options, which are named
+//by names. Returns false with an exception set if one is negative.
+bool multipart_Parser_parseLimits(multipart_parser_limits * limits, const Py_ssize_t * values, char * const * names);
+
 #endif
@@ -0,0 +1,374 @@
+#include <Python.h>
+#include <structmember.h>
+
+#include "multipart_PushParser.h"
+#include "multipart_Parser.h"
+#include "iso646.h"
+#include "stdbool.h"
+#include "multipart_parser.h"
+#include "multipart_events.h"
+
+//A parser that is handed each buffer as it arrives, instead of reading
+//its input, and returns what it found in the buffer as a list of events
+typedef struct
+{
+	PyObject_HEAD
+	multipart_parser * parser;
+	multipart_events events;
+	multipart_parser_limits limits;
+	
+	//Bytes fed to the parser so far
+	size_t bytesParsed;
+	//Set once the closing boundary has been seen
+	bool done;
+	//Set once the input turned out not to be multipart, at failedAt
+	bool failed;
+	size_t failedAt;
+	
+	//The header being parsed, which may span several buffers. The
+	//first headerFieldLength bytes are its name, the rest its value.
+	char * header;
+	size_t headerLength;
+	size_t headerSize;
+	size_t headerFieldLength;
+	
+	//The events without arguments are the same tuple every time
+	PyObject * partBegin;
+	PyObject * partEnd;
+	PyObject * bodyEnd;
+}multipart_PushParser;
+
+static PyObject* PushParser_new(PyTypeObject * type, PyObject * args, PyObject * kwds)
+{
+	multipart_PushParser * self = (multipart_PushParser*)type->tp_alloc(type,0);
+	
+	if(self!=NULL)
+	{
+		self->parser = NULL;
+		multipart_events_init(&self->events);
+		memset(&self->limits,0,sizeof(self->limits));
+		self->bytesParsed = 0;
+		self->done = false;
+		self->failed = false;
+		self->failedAt = 0;
+		
+		self->header = NULL;
+		self->headerLength = 0;
+		self->headerSize = 0;
+		self->headerFieldLength = 0;
+		
+		self->partBegin = NULL;
+		self->partEnd = NULL;
+		self->bodyEnd = NULL;
+	}
+	
+	return (PyObject*)self;
+}
+
+static void PushParser_dealloc(multipart_PushParser * self)
+{
+	if(self->parser)
+	{
+		multipart_parser_free(self->parser);
+	}
+	
+	multipart_events_free(&self->events);
+	PyMem_Free(self->header);
+	Py_XDECREF(self->partBegin);
+	Py_XDECREF(self->partEnd);
+	Py_XDECREF(self->bodyEnd);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject * notification(enum multipart_PushParser_event const kind)
+{
+	PyObject * const number = PyInt_FromLong(kind);
+	
+	if(not number)
+	{
+		return NULL;
+	}
+	
+	PyObject * const tuple = PyTuple_Pack(1,number);
+	Py_DECREF(number);
+	return tuple;
+}
+
+static int PushParser_init(multipart_PushParser * const self, PyObject * args, PyObject * kwds)
+{
+	char const * boundary;
+	Py_ssize_t limits[5] = {0,0,0,0,0};
+	static char * kwlist[] = {"boundary","max_header_bytes","max_headers_per_part","max_parts","max_part_bytes","max_total_bytes",NULL};
+	if( not PyArg_ParseTupleAndKeywords(args,kwds,"s|nnnnn",kwlist,&boundary,&limits[0],&limits[1],&limits[2],&limits[3],&limits[4]) )
+	{
+		return -1;
+	}
+	
+	if(not multipart_Parser_parseLimits(&self->limits,limits,kwlist + 1))
+	{
+		return -1;
+	}
+	
+	self->partBegin = notification(multipart_PushParser_PART_BEGIN);
+	self->partEnd = notification(multipart_PushParser_PART_END);
+	self->bodyEnd = notification(multipart_PushParser_BODY_END);
+	
+	if(not self->partBegin or not self->partEnd or not self->bodyEnd)
+	{
+		return -1;
+	}
+	
+	//The parser only records what it finds, and data spans are reported
+	//whole rather than split at each CR
+	self->parser = multipart_parser_init(boundary,&multipart_events_settings);
+	if( not self->parser )
+	{
+		PyErr_SetString(PyExc_MemoryError,"multipart_parser_init returned NULL");
+		return -1;
+	}
+	
+	multipart_parser_set_data(self->parser,&self->events);
+	multipart_parser_set_coalesce(self->parser,1);
+	multipart_parser_set_limits(self->parser,&self->limits);
+	
+	return 0;
+}
+
+static bool appendHeader(multipart_PushParser * const self, const char * const data, size_t const length)
+{
+	const size_t requiredSize = self->headerLength + length;
+	
+	if(requiredSize > self->headerSize)
+	{
+		const size_t newSize = requiredSize < 256 ? 256 : requiredSize * 2;
+		char * const newMem = PyMem_Realloc(self->header,newSize);
+		
+		if(not newMem)
+		{
+			PyErr_NoMemory();
+			return false;
+		}
+		self->header = newMem;
+		self->headerSize = newSize;
+	}
+	
+	memcpy(self->header + self->headerLength,data,length);
+	self->headerLength += length;
+	return true;
+}
+
+//Builds the tuple (kind, first) or (kind, first, second) depending on
+//size, stealing the references to first and second
+static PyObject * eventTuple(enum multipart_PushParser_event const kind, Py_ssize_t const size, PyObject * const first, PyObject * const second)
+{
+	PyObject * const tuple = PyTuple_New(size);
+	PyObject * const number = PyInt_FromLong(kind);
+	
+	if(not tuple or not number or not first or (size == 3 and not second))
+	{
+		Py_XDECREF(tuple);
+		Py_XDECREF(number);
+		Py_XDECREF(first);
+		Py_XDECREF(second);
+		return NULL;
+	}
+	
+	PyTuple_SET_ITEM(tuple,0,number);
+	PyTuple_SET_ITEM(tuple,1,first);
+	if(size == 3)
+	{
+		PyTuple_SET_ITEM(tuple,2,second);
+	}
+	return tuple;
+}
+
+//Turns one recorded event into what feed returns for it, if anything.
+//Returns false with an exception set on failure.
+static bool addEvent(multipart_PushParser * const self, PyObject * const batch, const multipart_event * const event)
+{
+	const char * const at = multipart_event_data(&self->events,event);
+	PyObject * item = NULL;
+	
+	switch(event->type)
+	{
+		case MULTIPART_EVENT_HEADER_FIELD:
+			self->headerFieldLength += event->length;
+			return appendHeader(self,at,event->length);
+		case MULTIPART_EVENT_HEADER_VALUE:
+			return appendHeader(self,at,event->length);
+		case MULTIPART_EVENT_HEADER_VALUE_END:
+			item = eventTuple(multipart_PushParser_HEADER,3,
+			                  PyString_FromStringAndSize(self->header,self->headerFieldLength),
+			                  PyString_FromStringAndSize(self->header + self->headerFieldLength,self->headerLength - self->headerFieldLength));
+			self->headerLength = 0;
+			self->headerFieldLength = 0;
+			break;
+		case MULTIPART_EVENT_PART_DATA:
+			//Bytes the parser held back from an earlier buffer are not
+			//part of this one
+			item = event->spilled ?
+			       eventTuple(multipart_PushParser_DATA_BYTES,2,PyString_FromStringAndSize(at,event->length),NULL) :
+			       eventTuple(multipart_PushParser_DATA,3,PyInt_FromSize_t(event->offset),PyInt_FromSize_t(event->length));
+			break;
+		case MULTIPART_EVENT_PART_DATA_BEGIN:
+			item = self->partBegin;
+			Py_INCREF(item);
+			break;
+		case MULTIPART_EVENT_PART_DATA_END:
+			item = self->partEnd;
+			Py_INCREF(item);
+			break;
+		case MULTIPART_EVENT_BODY_END:
+			self->done = true;
+			item = self->bodyEnd;
+			Py_INCREF(item);
+			break;
+		default:
+			return true;
+	}
+	
+	if(not item)
+	{
+		return false;
+	}
+	
+	const int appended = PyList_Append(batch,item);
+	Py_DECREF(item);
+	return appended == 0;
+}
+
+//Raises the error the parser stopped with
+static PyObject * raiseFailure(multipart_PushParser * const self)
+{
+	const enum multipart_limit limit = multipart_parser_limit_exceeded(self->parser);
+	
+	if(limit != MULTIPART_LIMIT_NONE)
+	{
+		multipart_Parser_raiseLimitError(&self->limits,limit,self->failedAt);
+		return NULL;
+	}
+	
+	PyErr_Format(PyExc_ValueError,"input not multipart, failed on byte %zu",self->failedAt);
+	return NULL;
+}
+
+static PyObject * PushParser_feed(multipart_PushParser * const self, PyObject * const buffer)
+{
+	const void * data;
+	Py_ssize_t length;
+	
+	if(PyUnicode_Check(buffer))
+	{
+		PyErr_SetString(PyExc_TypeError,"feed() takes bytes, not unicode");
+		return NULL;
+	}
+	
+	if(PyObject_AsReadBuffer(buffer,&data,&length) != 0)
+	{
+		return NULL;
+	}
+	
+	if(self->failed)
+	{
+		return raiseFailure(self);
+	}
+	
+	multipart_events_reset(&self->events,data,length);
+	const size_t parsed = multipart_parser_execute(self->parser,data,length);
+	
+	if(self->events.failed)
+	{
+		return PyErr_NoMemory();
+	}
+	
+	//Whatever came before an error is of no use to the caller
+	if(parsed != (size_t)length)
+	{
+		self->failed = true;
+		self->failedAt = self->bytesParsed + parsed;
+		return raiseFailure(self);
+	}
+	self->bytesParsed += parsed;
+	
+	PyObject * const batch = PyList_New(0);
+	
+	if(not batch)
+	{
+		return NULL;
+	}
+	
+	for(size_t i = 0; i < self->events.length; i++)
+	{
+		if(not addEvent(self,batch,&self->events.events[i]))
+		{
+			Py_DECREF(batch);
+			return NULL;
+		}
+	}
+	
+	return batch;
+}
+
+static PyObject * PushParser_close(multipart_PushParser * const self, PyObject * const unused)
+{
+	if(not self->done)
+	{
+		PyErr_SetString(PyExc_ValueError,"input ended before the closing boundary");
+		return NULL;
+	}
+	
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef PushParser_methods[] = {
+	{"feed",(PyCFunction)PushParser_feed, METH_O, "feed(buffer)\n\nParses the next buffer of the body and returns a list of event tuples,\nwith part data as (DATA, offset, length) spans of buffer."},
+	{"close",(PyCFunction)PushParser_close, METH_NOARGS, "close()\n\nRaises ValueError unless the closing boundary has been fed."},
+	{NULL,NULL,0,NULL}
+};
+static PyMemberDef PushParser_members[] = {
+	{"done",T_BOOL,offsetof(multipart_PushParser,done),READONLY,"True once the closing boundary has been fed"},
+	{NULL}
+};
+
+PyTypeObject multipart_PushParserType = {
+	PyObject_HEAD_INIT(NULL)
+	0,                         /*ob_size*/
+    "multipart.PushParser",             /*tp_name*/
+    sizeof(multipart_PushParser), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)PushParser_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_HAVE_CLASS,        /*tp_flags*/
+    "PushParser objects",           /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,              /* tp_iternext */
+    PushParser_methods,             /* tp_methods */
+    PushParser_members,             /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)PushParser_init,      /* tp_init */
+    0,                         /* tp_alloc */
+    PushParser_new                 /* tp_new */
+	
+};
@@ -0,0 +1,27 @@
+#include <Python.h>
+#include <structmember.h>
+
+#ifndef __multipart_PushParser
+#define __multipart_PushParser
+
+extern PyTypeObject multipart_PushParserType;
+
+//The first item of each event tuple returned by PushParser.feed, exposed
+//on the module under the same names
+enum multipart_PushParser_event
+{
+	//(PART_BEGIN,)
+	multipart_PushParser_PART_BEGIN,
+	//(HEADER, name, value)
+	multipart_PushParser_HEADER,
+	//(DATA, offset, length), a span of the buffer passed to feed
+	multipart_PushParser_DATA,
+	//(DATA_BYTES, string), data held back from an earlier buffer
+	multipart_PushParser_DATA_BYTES,
+	//(PART_END,)
+	multipart_PushParser_PART_END,
+	//(BODY_END,)
+	multipart_PushParser_BODY_END
+};
+
+#endif
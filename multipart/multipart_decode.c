@@ -0,0 +1,357 @@
+/* Streaming decoders for the Content-Transfer-Encoding of part data.
+ * Input may be split anywhere, an incomplete quantum or escape is
+ * carried over to the next call.
+ */
+
+#include "multipart_decode.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "iso646.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MULTIPART_BASE64_DISPATCH
+#endif
+
+/* The value of each base64 character, 0x80 for anything else */
+static const unsigned char base64_value[256] = {
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 62, 128, 128, 128, 63,
+  52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 128, 128, 128, 128, 128, 128,
+  128, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+  15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 128, 128, 128, 128, 128,
+  128, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+  41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128
+};
+
+static int hex_value(unsigned char c) {
+  if (c >= '0' and c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' and c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' and c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+static size_t base64_quanta_scalar(const unsigned char* in, size_t length, unsigned char* out) {
+  size_t i = 0;
+
+  for (; i + 4 <= length; i += 4, out += 3) {
+    const uint32_t a = base64_value[in[i]];
+    const uint32_t b = base64_value[in[i + 1]];
+    const uint32_t c = base64_value[in[i + 2]];
+    const uint32_t e = base64_value[in[i + 3]];
+
+    if ((a | b | c | e) & 0x80) {
+      break;
+    }
+    const uint32_t v = a << 18 | b << 12 | c << 6 | e;
+    out[0] = v >> 16;
+    out[1] = v >> 8;
+    out[2] = v;
+  }
+  return i;
+}
+
+#ifdef MULTIPART_BASE64_DISPATCH
+/* Sixteen characters at a time: the nibbles of each byte are looked up
+ * to reject anything outside the alphabet and to find the offset that
+ * turns the character into its sextet, then the sextets are packed
+ * into 12 bytes. */
+__attribute__((target("ssse3")))
+static size_t base64_quanta_ssse3(const unsigned char* in, size_t length, unsigned char* out) {
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  size_t n = 0;
+
+  for (; i + sizeof(__m128i) <= length; i += sizeof(__m128i), n += 12) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(v, mask_2f));
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) != 0xffff) {
+      break;
+    }
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, mask_2f), hi_nibbles));
+    const __m128i sextets = _mm_add_epi8(v, roll);
+    const __m128i pairs = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+    const __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    const __m128i bytes = _mm_shuffle_epi8(words, pack);
+    const uint32_t last = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+
+    _mm_storel_epi64((__m128i*)(out + n), bytes);
+    memcpy(out + n + 8, &last, 4);
+  }
+  return i + base64_quanta_scalar(in + i, length - i, out + n);
+}
+#endif
+
+static multipart_base64_fn multipart_select_base64(void) {
+#ifdef MULTIPART_BASE64_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    return base64_quanta_ssse3;
+  }
+#endif
+  return base64_quanta_scalar;
+}
+
+void multipart_decoder_init(multipart_decoder* d, enum multipart_encoding encoding) {
+  d->encoding = encoding;
+  d->carry_length = 0;
+  d->pending_length = 0;
+  if (encoding == MULTIPART_ENCODING_BASE64) {
+    d->base64_quanta = multipart_select_base64();
+  }
+}
+
+size_t multipart_decoder_bound(const multipart_decoder* d, size_t length) {
+  if (d->encoding == MULTIPART_ENCODING_BASE64) {
+    return (d->carry_length + length) / 4 * 3 + 3;
+  }
+  return d->pending_length + d->carry_length + length;
+}
+
+/* Decodes the sextets carried before padding or the end of the data */
+static size_t base64_flush(multipart_decoder* d, unsigned char* out) {
+  const unsigned char* const s = d->carry;
+  const size_t length = d->carry_length;
+
+  d->carry_length = 0;
+  if (length < 2) {
+    return 0;
+  }
+  out[0] = s[0] << 2 | s[1] >> 4;
+  if (length == 2) {
+    return 1;
+  }
+  out[1] = s[1] << 4 | s[2] >> 2;
+  return 2;
+}
+
+static size_t base64_update(multipart_decoder* d, const unsigned char* in, size_t length, unsigned char* out) {
+  size_t i = 0;
+  size_t n = 0;
+
+  while (i < length) {
+    //Whole quanta of alphabet characters are decoded in bulk;
+    //line breaks and padding go through the loop below
+    if (d->carry_length == 0) {
+      const size_t used = d->base64_quanta(in + i, length - i, out + n);
+      i += used;
+      n += used / 4 * 3;
+      if (i == length) {
+        break;
+      }
+    }
+
+    const unsigned char c = in[i++];
+    const unsigned char v = base64_value[c];
+
+    if (v & 0x80) {
+      if (c == '=') {
+        n += base64_flush(d, out + n);
+      }
+      continue;
+    }
+
+    d->carry[d->carry_length++] = v;
+    if (d->carry_length == 4) {
+      const unsigned char* const s = d->carry;
+      out[n] = s[0] << 2 | s[1] >> 4;
+      out[n + 1] = s[1] << 4 | s[2] >> 2;
+      out[n + 2] = s[2] << 6 | s[3];
+      n += 3;
+      d->carry_length = 0;
+    }
+  }
+  return n;
+}
+
+static int is_space(unsigned char c) {
+  return c == ' ' or c == '\t';
+}
+
+/* Copies literal data that may hold line breaks. The spaces and tabs
+ * written since settled that end a line are taken out again. */
+static size_t qp_literal(const unsigned char* in, size_t length, unsigned char* out, size_t n, size_t* settled) {
+  while (length) {
+    const unsigned char* const lf = memchr(in, '\n', length);
+    const size_t run = lf ? (size_t)(lf - in) + 1 : length;
+
+    memcpy(out + n, in, run);
+    n += run;
+    in += run;
+    length -= run;
+    if (not lf) {
+      break;
+    }
+
+    size_t end = n - 1;
+    if (end > *settled and out[end - 1] == '\r') {
+      end--;
+    }
+    size_t start = end;
+    while (start > *settled and is_space(out[start - 1])) {
+      start--;
+    }
+    memmove(out + start, out + end, n - end);
+    n = start + (n - end);
+    *settled = n;
+  }
+  return n;
+}
+
+static size_t qp_update(multipart_decoder* d, const unsigned char* in, size_t length, unsigned char* out) {
+  size_t i = 0;
+  //Spaces and tabs from the previous call go first, and with what was
+  //written before settled they are the only output that can be dropped
+  size_t n = d->pending_length;
+  size_t settled = 0;
+
+  memcpy(out, d->pending, n);
+  d->pending_length = 0;
+
+  while (i < length) {
+    //Everything up to the next '=' is literal
+    if (d->carry_length == 0) {
+      const unsigned char* const escape = memchr(in + i, '=', length - i);
+      const size_t run = escape ? (size_t)(escape - (in + i)) : length - i;
+
+      n = qp_literal(in + i, run, out, n, &settled);
+      i += run;
+      if (i == length) {
+        break;
+      }
+      d->carry[d->carry_length++] = '=';
+      settled = n;
+      i++;
+      continue;
+    }
+
+    const unsigned char c = in[i++];
+    d->carry[d->carry_length++] = c;
+
+    if (d->carry_length == 2) {
+      //"=\n" is a soft line break, "=\r" and "=X" need one more byte
+      if (c == '\n') {
+        d->carry_length = 0;
+      } else if (c != '\r' and hex_value(c) < 0) {
+        out[n++] = '=';
+        settled = n;
+        d->carry_length = 0;
+        i--;
+      }
+      continue;
+    }
+
+    if (d->carry[1] == '\r' and c == '\n') {
+      d->carry_length = 0;
+      continue;
+    }
+    if (d->carry[1] != '\r' and hex_value(c) >= 0) {
+      out[n++] = hex_value(d->carry[1]) << 4 | hex_value(c);
+      settled = n;
+      d->carry_length = 0;
+      continue;
+    }
+
+    //Not an escape after all, so the '=' and the byte after it are
+    //data and c is looked at again
+    out[n++] = '=';
+    out[n++] = d->carry[1];
+    settled = n;
+    d->carry_length = 0;
+    i--;
+  }
+
+  //Spaces and tabs at the end, and a CR after them, wait for the next
+  //call to tell whether the line ends there. A run too long for a
+  //conforming line is only held back in part.
+  size_t keep = n;
+  if (keep > settled and out[keep - 1] == '\r') {
+    keep--;
+  }
+  while (keep > settled and is_space(out[keep - 1])) {
+    keep--;
+  }
+  if (n - keep > sizeof(d->pending)) {
+    keep = n - sizeof(d->pending);
+  }
+  memcpy(d->pending, out + keep, n - keep);
+  d->pending_length = n - keep;
+  return keep;
+}
+
+size_t multipart_decoder_update(multipart_decoder* d, const char* in, size_t length, char* out) {
+  switch (d->encoding) {
+    case MULTIPART_ENCODING_BASE64:
+      return base64_update(d, (const unsigned char*)in, length, (unsigned char*)out);
+    case MULTIPART_ENCODING_QUOTED_PRINTABLE:
+      return qp_update(d, (const unsigned char*)in, length, (unsigned char*)out);
+    default:
+      memcpy(out, in, length);
+      return length;
+  }
+}
+
+size_t multipart_decoder_finish(multipart_decoder* d, char* out) {
+  if (d->encoding == MULTIPART_ENCODING_BASE64) {
+    return base64_flush(d, (unsigned char*)out);
+  }
+
+  //The data ends a line, so the spaces and tabs before it go but a
+  //stray CR stays
+  size_t length = 0;
+  if (d->pending_length and d->pending[d->pending_length - 1] == '\r') {
+    out[length++] = '\r';
+  }
+  d->pending_length = 0;
+
+  memcpy(out + length, d->carry, d->carry_length);
+  length += d->carry_length;
+  d->carry_length = 0;
+  return length;
+}
+
+enum multipart_encoding multipart_encoding_from_name(const char* name, size_t length) {
+  while (length and (*name == ' ' or *name == '\t')) {
+    name++;
+    length--;
+  }
+  while (length and (name[length - 1] == ' ' or name[length - 1] == '\t')) {
+    length--;
+  }
+
+  if (length == 6 and strncasecmp(name, "base64", 6) == 0) {
+    return MULTIPART_ENCODING_BASE64;
+  }
+  if (length == 16 and strncasecmp(name, "quoted-printable", 16) == 0) {
+    return MULTIPART_ENCODING_QUOTED_PRINTABLE;
+  }
+  return MULTIPART_ENCODING_IDENTITY;
+}
@@ -0,0 +1,61 @@
+/* Streaming decoders for the Content-Transfer-Encoding of part data.
+ * Input may be split anywhere, an incomplete quantum or escape is
+ * carried over to the next call.
+ */
+#ifndef _multipart_decode_h
+#define _multipart_decode_h
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+enum multipart_encoding {
+  MULTIPART_ENCODING_IDENTITY = 0, /* 7bit, 8bit, binary or unknown */
+  MULTIPART_ENCODING_BASE64,
+  MULTIPART_ENCODING_QUOTED_PRINTABLE
+};
+
+/* Decodes the whole quanta of alphabet characters at the start of in
+ * and returns the number of characters used, a multiple of 4 */
+typedef size_t (*multipart_base64_fn)(const unsigned char* in, size_t length, unsigned char* out);
+
+typedef struct multipart_decoder {
+  enum multipart_encoding encoding;
+  /* Base64 sextets or the quoted-printable escape read so far */
+  unsigned char carry[4];
+  size_t carry_length;
+  /* Quoted-printable spaces and tabs at the end of the data so far,
+   * perhaps followed by a CR. They are dropped if the line ends there. */
+  unsigned char pending[80];
+  size_t pending_length;
+  multipart_base64_fn base64_quanta;
+} multipart_decoder;
+
+void multipart_decoder_init(multipart_decoder* d, enum multipart_encoding encoding);
+
+/* The most bytes multipart_decoder_update can write for length bytes
+ * of input */
+size_t multipart_decoder_bound(const multipart_decoder* d, size_t length);
+
+/* Decodes length bytes from in to out and returns the number of bytes
+ * written. Characters outside the base64 alphabet are skipped, and a
+ * malformed quoted-printable escape is passed through as is. Spaces and
+ * tabs at the end of a quoted-printable line are transport padding and
+ * are removed, as RFC 2045 asks. */
+size_t multipart_decoder_update(multipart_decoder* d, const char* in, size_t length, char* out);
+
+/* Writes what is left of a carried quantum or escape at the end of the
+ * data, at most 3 bytes, and returns the number written */
+size_t multipart_decoder_finish(multipart_decoder* d, char* out);
+
+/* The encoding named by a Content-Transfer-Encoding header value */
+enum multipart_encoding multipart_encoding_from_name(const char* name, size_t length);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
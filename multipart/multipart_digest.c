@@ -0,0 +1,379 @@
+/* Incremental MD5, SHA-1, SHA-256 and CRC-32C digests, so part data
+ * can be checked as it goes through the parser.
+ */
+
+#include "multipart_digest.h"
+
+#include <string.h>
+#include "iso646.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define MULTIPART_CRC32C_DISPATCH
+#endif
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+typedef void (*multipart_block_fn)(uint32_t* state, const unsigned char* block);
+
+static uint32_t load_le32(const unsigned char* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t load_be32(const unsigned char* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void store_le32(unsigned char* p, uint32_t x) {
+  p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+static void store_be32(unsigned char* p, uint32_t x) {
+  p[0] = x >> 24; p[1] = x >> 16; p[2] = x >> 8; p[3] = x;
+}
+
+static const uint32_t md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned char md5_s[16] = {
+  7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static void md5_block(uint32_t* state, const unsigned char* block) {
+  uint32_t m[16];
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+
+  for (int i = 0; i < 16; i++) {
+    m[i] = load_le32(block + 4 * i);
+  }
+
+  for (int i = 0; i < 64; i++) {
+    uint32_t f;
+    int g;
+
+    if (i < 16) {
+      f = d ^ (b & (c ^ d));
+      g = i;
+    } else if (i < 32) {
+      f = c ^ (d & (b ^ c));
+      g = (5 * i + 1) & 15;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) & 15;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) & 15;
+    }
+
+    f += a + md5_k[i] + m[g];
+    a = d;
+    d = c;
+    c = b;
+    b += ROTL(f, md5_s[(i >> 4) * 4 + (i & 3)]);
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+}
+
+static void sha1_block(uint32_t* state, const unsigned char* block) {
+  uint32_t w[80];
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = load_be32(block + 4 * i);
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = ROTL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+  }
+
+  for (int i = 0; i < 80; i++) {
+    uint32_t f, k;
+
+    if (i < 20) {
+      f = d ^ (b & (c ^ d));
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (d & (b | c));
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+
+    const uint32_t t = ROTL(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROTL(b, 30);
+    b = a;
+    a = t;
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+}
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_block(uint32_t* state, const unsigned char* block) {
+  uint32_t w[64];
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = load_be32(block + 4 * i);
+  }
+  for (int i = 16; i < 64; i++) {
+    const uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+    const uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+
+  for (int i = 0; i < 64; i++) {
+    const uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + (g ^ (e & (f ^ g))) + sha256_k[i] + w[i];
+    const uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) | (c & (a | b)));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void hash_update(multipart_hash* h, multipart_block_fn block, const unsigned char* data, size_t length) {
+  const size_t used = h->length % 64;
+  h->length += length;
+
+  if (used) {
+    const size_t take = length < 64 - used ? length : 64 - used;
+    memcpy(h->block + used, data, take);
+    data += take;
+    length -= take;
+    if (used + take < 64) {
+      return;
+    }
+    block(h->state, h->block);
+  }
+
+  for (; length >= 64; data += 64, length -= 64) {
+    block(h->state, data);
+  }
+  memcpy(h->block, data, length);
+}
+
+/* Pads the message with 0x80, zeros and its length in bits */
+static void hash_pad(multipart_hash* h, multipart_block_fn block, int big_endian) {
+  static const unsigned char padding[64] = { 0x80 };
+  unsigned char bits[8];
+  const uint64_t length = h->length * 8;
+  const size_t used = h->length % 64;
+
+  for (int i = 0; i < 8; i++) {
+    bits[big_endian ? 7 - i : i] = length >> (8 * i);
+  }
+  hash_update(h, block, padding, used < 56 ? 56 - used : 120 - used);
+  hash_update(h, block, bits, 8);
+}
+
+static const uint32_t crc32c_table[256] = {
+  0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+  0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+  0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+  0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+  0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+  0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+  0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+  0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+  0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+  0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+  0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+  0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+  0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+  0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+  0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+  0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+  0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+  0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+  0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+  0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+  0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+  0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+  0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+  0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+  0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+  0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+  0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+  0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+  0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+  0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+  0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+  0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+  0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+  0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+  0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+  0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+  0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+  0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+  0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+  0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+  0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+  0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+  0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+
+static uint32_t crc32c_scalar(uint32_t crc, const unsigned char* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    crc = crc32c_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef MULTIPART_CRC32C_DISPATCH
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t length) {
+  uint64_t crc64 = crc;
+  size_t i = 0;
+
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint32_t)crc64;
+  for (; i < length; i++) {
+    crc = _mm_crc32_u8(crc, data[i]);
+  }
+  return crc;
+}
+#endif
+
+static uint32_t (*multipart_select_crc32c(void))(uint32_t, const unsigned char*, size_t) {
+#ifdef MULTIPART_CRC32C_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    return crc32c_sse42;
+  }
+#endif
+  return crc32c_scalar;
+}
+
+static const char* const multipart_digest_names[MULTIPART_DIGEST_KINDS] = {
+  "md5", "sha1", "sha256", "crc32c"
+};
+
+void multipart_digest_init(multipart_digest* d, unsigned kinds) {
+  static const uint32_t md5_init[4] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+  };
+  static const uint32_t sha1_init[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+  };
+  static const uint32_t sha256_init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memset(d, 0, sizeof(*d));
+  d->kinds = kinds;
+  memcpy(d->md5.state, md5_init, sizeof(md5_init));
+  memcpy(d->sha1.state, sha1_init, sizeof(sha1_init));
+  memcpy(d->sha256.state, sha256_init, sizeof(sha256_init));
+  d->crc32c = 0xffffffff;
+  if (kinds & MULTIPART_DIGEST_CRC32C) {
+    d->crc32c_update = multipart_select_crc32c();
+  }
+}
+
+void multipart_digest_update(multipart_digest* d, const char* data, size_t length) {
+  const unsigned char* const bytes = (const unsigned char*)data;
+
+  if (d->kinds & MULTIPART_DIGEST_MD5) {
+    hash_update(&d->md5, md5_block, bytes, length);
+  }
+  if (d->kinds & MULTIPART_DIGEST_SHA1) {
+    hash_update(&d->sha1, sha1_block, bytes, length);
+  }
+  if (d->kinds & MULTIPART_DIGEST_SHA256) {
+    hash_update(&d->sha256, sha256_block, bytes, length);
+  }
+  if (d->kinds & MULTIPART_DIGEST_CRC32C) {
+    d->crc32c = d->crc32c_update(d->crc32c, bytes, length);
+  }
+}
+
+size_t multipart_digest_final(const multipart_digest* d, enum multipart_digest_kind kind, unsigned char* out) {
+  multipart_hash h;
+
+  switch (kind) {
+    case MULTIPART_DIGEST_MD5:
+      h = d->md5;
+      hash_pad(&h, md5_block, 0);
+      for (int i = 0; i < 4; i++) {
+        store_le32(out + 4 * i, h.state[i]);
+      }
+      return 16;
+
+    case MULTIPART_DIGEST_SHA1:
+      h = d->sha1;
+      hash_pad(&h, sha1_block, 1);
+      for (int i = 0; i < 5; i++) {
+        store_be32(out + 4 * i, h.state[i]);
+      }
+      return 20;
+
+    case MULTIPART_DIGEST_SHA256:
+      h = d->sha256;
+      hash_pad(&h, sha256_block, 1);
+      for (int i = 0; i < 8; i++) {
+        store_be32(out + 4 * i, h.state[i]);
+      }
+      return 32;
+
+    case MULTIPART_DIGEST_CRC32C:
+      store_be32(out, ~d->crc32c);
+      return 4;
+  }
+  return 0;
+}
+
+const char* multipart_digest_name(enum multipart_digest_kind kind) {
+  for (int i = 0; i < MULTIPART_DIGEST_KINDS; i++) {
+    if (kind == 1u << i) {
+      return multipart_digest_names[i];
+    }
+  }
+  return NULL;
+}
+
+unsigned multipart_digest_from_name(const char* name) {
+  for (int i = 0; i < MULTIPART_DIGEST_KINDS; i++) {
+    if (strcmp(name, multipart_digest_names[i]) == 0) {
+      return 1u << i;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+/* Incremental MD5, SHA-1, SHA-256 and CRC-32C digests, so part data
+ * can be checked as it goes through the parser.
+ */
+#ifndef _multipart_digest_h
+#define _multipart_digest_h
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Flags selecting the digests to compute */
+enum multipart_digest_kind {
+  MULTIPART_DIGEST_MD5 = 1 << 0,
+  MULTIPART_DIGEST_SHA1 = 1 << 1,
+  MULTIPART_DIGEST_SHA256 = 1 << 2,
+  MULTIPART_DIGEST_CRC32C = 1 << 3
+};
+
+#define MULTIPART_DIGEST_KINDS 4
+#define MULTIPART_DIGEST_MAX_SIZE 32
+
+/* State of a hash over 64 byte blocks */
+typedef struct multipart_hash {
+  uint32_t state[8];
+  uint64_t length;
+  unsigned char block[64];
+} multipart_hash;
+
+typedef struct multipart_digest {
+  unsigned kinds;
+  multipart_hash md5;
+  multipart_hash sha1;
+  multipart_hash sha256;
+  uint32_t crc32c;
+  uint32_t (*crc32c_update)(uint32_t crc, const unsigned char* data, size_t length);
+} multipart_digest;
+
+void multipart_digest_init(multipart_digest* d, unsigned kinds);
+void multipart_digest_update(multipart_digest* d, const char* data, size_t length);
+
+/* Writes the digest of one kind, as bytes in the usual order, to out
+ * and returns its length. The state is left as it was. */
+size_t multipart_digest_final(const multipart_digest* d, enum multipart_digest_kind kind, unsigned char* out);
+
+/* "md5", "sha1", "sha256" or "crc32c" */
+const char* multipart_digest_name(enum multipart_digest_kind kind);
+
+/* The kind with the given name, or 0 if there is none */
+unsigned multipart_digest_from_name(const char* name);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
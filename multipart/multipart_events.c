@@ -0,0 +1,132 @@
+/* Records the callbacks of a multipart_parser as a flat list of events,
+ * so the parser can run without touching any Python objects.
+ */
+
+#include "multipart_events.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "iso646.h"
+
+static multipart_event* multipart_events_append(multipart_events* e) {
+  if (e->length == e->size) {
+    const size_t size = e->size ? e->size * 2 : 64;
+    multipart_event* const events = realloc(e->events, size * sizeof(multipart_event));
+
+    if (not events) {
+      e->failed = true;
+      return NULL;
+    }
+    e->events = events;
+    e->size = size;
+  }
+  return &e->events[e->length++];
+}
+
+static int multipart_events_span(multipart_events* e, unsigned char type, const char* at, size_t length) {
+  const bool in_base = at >= e->base and at + length <= e->base + e->base_length;
+  size_t offset;
+
+  if (in_base) {
+    offset = at - e->base;
+
+    //A span that continues the previous one of the same kind extends it
+    if (e->length) {
+      multipart_event* const last = &e->events[e->length - 1];
+      if (last->type == type and not last->spilled and last->offset + last->length == offset) {
+        last->length += length;
+        return 0;
+      }
+    }
+  } else {
+    if (e->spill_length + length > e->spill_size) {
+      const size_t size = (e->spill_length + length) * 2;
+      char* const spill = realloc(e->spill, size);
+
+      if (not spill) {
+        e->failed = true;
+        return 1;
+      }
+      e->spill = spill;
+      e->spill_size = size;
+    }
+    offset = e->spill_length;
+    memcpy(e->spill + offset, at, length);
+    e->spill_length += length;
+  }
+
+  multipart_event* const ev = multipart_events_append(e);
+  if (not ev) {
+    return 1;
+  }
+  ev->type = type;
+  ev->spilled = not in_base;
+  ev->offset = offset;
+  ev->length = length;
+  return 0;
+}
+
+static int multipart_events_notify(multipart_events* e, unsigned char type) {
+  multipart_event* const ev = multipart_events_append(e);
+  if (not ev) {
+    return 1;
+  }
+  ev->type = type;
+  ev->spilled = false;
+  ev->offset = 0;
+  ev->length = 0;
+  return 0;
+}
+
+#define SPAN_CB(NAME, TYPE)                                            \
+static int multipart_events_on_##NAME(void* e, const char* at, size_t length) { \
+  return multipart_events_span(e, TYPE, at, length);                  \
+}
+
+#define NOTIFY_CB(NAME, TYPE)                                          \
+static int multipart_events_on_##NAME(void* e) {                      \
+  return multipart_events_notify(e, TYPE);                             \
+}
+
+SPAN_CB(header_field, MULTIPART_EVENT_HEADER_FIELD)
+SPAN_CB(header_value, MULTIPART_EVENT_HEADER_VALUE)
+SPAN_CB(part_data, MULTIPART_EVENT_PART_DATA)
+NOTIFY_CB(header_value_end, MULTIPART_EVENT_HEADER_VALUE_END)
+NOTIFY_CB(part_data_begin, MULTIPART_EVENT_PART_DATA_BEGIN)
+NOTIFY_CB(headers_complete, MULTIPART_EVENT_HEADERS_COMPLETE)
+NOTIFY_CB(part_data_end, MULTIPART_EVENT_PART_DATA_END)
+NOTIFY_CB(body_end, MULTIPART_EVENT_BODY_END)
+
+const multipart_parser_settings multipart_events_settings = {
+  multipart_events_on_header_field,
+  multipart_events_on_header_value,
+  multipart_events_on_part_data,
+
+  multipart_events_on_header_value_end,
+  multipart_events_on_part_data_begin,
+  multipart_events_on_headers_complete,
+  multipart_events_on_part_data_end,
+  multipart_events_on_body_end
+};
+
+void multipart_events_init(multipart_events* e) {
+  memset(e, 0, sizeof(*e));
+}
+
+void multipart_events_free(multipart_events* e) {
+  free(e->events);
+  free(e->spill);
+  multipart_events_init(e);
+}
+
+void multipart_events_reset(multipart_events* e, const char* base, size_t length) {
+  e->length = 0;
+  e->spill_length = 0;
+  e->failed = false;
+  e->base = base;
+  e->base_length = length;
+}
+
+const char* multipart_event_data(const multipart_events* e, const multipart_event* ev) {
+  return (ev->spilled ? e->spill : e->base) + ev->offset;
+}
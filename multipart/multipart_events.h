@@ -0,0 +1,72 @@
+/* Records the callbacks of a multipart_parser as a flat list of events,
+ * so the parser can run without touching any Python objects.
+ */
+#ifndef _multipart_events_h
+#define _multipart_events_h
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include "multipart_parser.h"
+
+enum multipart_event_type {
+  /* Events that carry a span of data */
+  MULTIPART_EVENT_HEADER_FIELD,
+  MULTIPART_EVENT_HEADER_VALUE,
+  MULTIPART_EVENT_PART_DATA,
+
+  /* Notifications */
+  MULTIPART_EVENT_HEADER_VALUE_END,
+  MULTIPART_EVENT_PART_DATA_BEGIN,
+  MULTIPART_EVENT_HEADERS_COMPLETE,
+  MULTIPART_EVENT_PART_DATA_END,
+  MULTIPART_EVENT_BODY_END
+};
+
+typedef struct multipart_event {
+  unsigned char type;
+  /* Set if the span was copied to the spill area because it did not lie
+   * inside the buffer being parsed. offset is then relative to spill. */
+  bool spilled;
+  size_t offset;
+  size_t length;
+} multipart_event;
+
+typedef struct multipart_events {
+  multipart_event* events;
+  size_t length;
+  size_t size;
+
+  /* The buffer passed to multipart_parser_execute */
+  const char* base;
+  size_t base_length;
+
+  /* Copies of spans from outside base, such as the parser's lookbehind */
+  char* spill;
+  size_t spill_length;
+  size_t spill_size;
+
+  /* Set when an allocation failed while recording */
+  bool failed;
+} multipart_events;
+
+/* Settings whose callbacks expect a multipart_events* as parser data */
+extern const multipart_parser_settings multipart_events_settings;
+
+void multipart_events_init(multipart_events* e);
+void multipart_events_free(multipart_events* e);
+
+/* Forgets all events and records spans relative to base from now on */
+void multipart_events_reset(multipart_events* e, const char* base, size_t length);
+
+/* Start of the data of a span event */
+const char* multipart_event_data(const multipart_events* e, const multipart_event* ev);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,814 @@
+#include <Python.h>
+
+#include "multipart_parse.h"
+#include "iso646.h"
+#include "stdbool.h"
+#include "multipart_parser.h"
+#include "multipart_events.h"
+#include <pthread.h>
+#include <unistd.h>
+
+//One body of a batch, parsed by whichever worker claims it
+typedef struct parseJob {
+	char const * boundary;
+	char const * body;
+	size_t length;
+	
+	multipart_events events;
+	size_t parsed;
+	//Set if the parser could not be created
+	bool failed;
+} parseJob;
+
+typedef struct parseBatch {
+	parseJob * jobs;
+	size_t count;
+	//The index of the next job nobody has claimed yet
+	size_t next;
+} parseBatch;
+
+static void runJob(parseJob * const job)
+{
+	multipart_parser * const parser = multipart_parser_init(job->boundary,&multipart_events_settings);
+	
+	if(not parser)
+	{
+		job->failed = true;
+		return;
+	}
+	
+	multipart_parser_set_coalesce(parser,1);
+	multipart_parser_set_data(parser,&job->events);
+	multipart_events_reset(&job->events,job->body,job->length);
+	job->parsed = multipart_parser_execute(parser,job->body,job->length);
+	multipart_parser_free(parser);
+}
+
+//The number of threads to run for a caller asking for workers, with 0
+//meaning one per CPU. More threads than CPUs would only take turns.
+static Py_ssize_t workerCount(Py_ssize_t const workers)
+{
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	const Py_ssize_t available = cpus > 0 ? cpus : 1;
+	
+	return workers == 0 or workers > available ? available : workers;
+}
+
+//Runs fn on workers threads, this one included, with thread i getting
+//arg + i * stride. The GIL is released while they run.
+static void runWorkers(void * (* const fn)(void *), char * const arg, size_t const stride, Py_ssize_t const workers)
+{
+	pthread_t * const threads = workers > 1 ? PyMem_Malloc((workers - 1) * sizeof(pthread_t)) : NULL;
+	Py_ssize_t started = 0;
+	
+	Py_BEGIN_ALLOW_THREADS
+	
+	while(threads and started < workers - 1 and pthread_create(&threads[started],NULL,fn,arg + (started + 1) * stride) == 0)
+	{
+		started++;
+	}
+	
+	fn(arg);
+	
+	for(Py_ssize_t i = 0; i < started; i++)
+	{
+		pthread_join(threads[i],NULL);
+	}
+	
+	//Work meant for threads that could not be started is done here.
+	//Without a stride every thread takes jobs until there are none left,
+	//so this thread has already done it.
+	if(stride)
+	{
+		for(Py_ssize_t i = started + 1; i < workers; i++)
+		{
+			fn(arg + i * stride);
+		}
+	}
+	
+	Py_END_ALLOW_THREADS
+	
+	PyMem_Free(threads);
+}
+
+//Runs without the GIL. Takes jobs until there are none left.
+static void * worker(void * const arg)
+{
+	parseBatch * const batch = arg;
+	size_t index;
+	
+	while((index = __sync_fetch_and_add(&batch->next,1)) < batch->count)
+	{
+		runJob(&batch->jobs[index]);
+	}
+	
+	return NULL;
+}
+
+//Appends a span to *str, creating it on the first span
+static bool appendSpan(PyObject ** const str, char const * const at, size_t const length)
+{
+	PyObject * const span = PyString_FromStringAndSize(at,length);
+	
+	if(not span)
+	{
+		return false;
+	}
+	
+	if(not *str)
+	{
+		*str = span;
+		return true;
+	}
+	
+	PyString_ConcatAndDel(str,span);
+	return *str != NULL;
+}
+
+static PyObject * emptyIfNull(PyObject * const str)
+{
+	return str ? str : PyString_FromStringAndSize(NULL,0);
+}
+
+//Handles the header events of a part, appending a (name, value) tuple
+//to headers once a value ends
+static bool headerEvent(PyObject * const headers, PyObject ** const field, PyObject ** const value, const multipart_event * const event, char const * const at)
+{
+	switch(event->type)
+	{
+		case MULTIPART_EVENT_HEADER_FIELD:
+			return appendSpan(field,at,event->length);
+		case MULTIPART_EVENT_HEADER_VALUE:
+			return appendSpan(value,at,event->length);
+	}
+	
+	PyObject * const header = Py_BuildValue("(NN)",emptyIfNull(*field),emptyIfNull(*value));
+	*field = NULL;
+	*value = NULL;
+	const bool ok = header and PyList_Append(headers,header) == 0;
+	Py_XDECREF(header);
+	return ok;
+}
+
+PyObject * multipart_parse_buildParts(const multipart_events * const events)
+{
+	PyObject * parts = PyList_New(0);
+	PyObject * headers = NULL;
+	PyObject * field = NULL;
+	PyObject * value = NULL;
+	PyObject * data = NULL;
+	
+	if(not parts)
+	{
+		return NULL;
+	}
+	
+	for(size_t i = 0; i < events->length; i++)
+	{
+		const multipart_event * const event = &events->events[i];
+		const char * const at = multipart_event_data(events,event);
+		bool ok = true;
+		
+		switch(event->type)
+		{
+			case MULTIPART_EVENT_HEADER_FIELD:
+			case MULTIPART_EVENT_HEADER_VALUE:
+			case MULTIPART_EVENT_HEADER_VALUE_END:
+				ok = headerEvent(headers,&field,&value,event,at);
+				break;
+			case MULTIPART_EVENT_PART_DATA:
+				ok = appendSpan(&data,at,event->length);
+				break;
+			case MULTIPART_EVENT_PART_DATA_BEGIN:
+				Py_CLEAR(headers);
+				Py_CLEAR(data);
+				headers = PyList_New(0);
+				ok = headers != NULL;
+				break;
+			case MULTIPART_EVENT_PART_DATA_END:
+			{
+				PyObject * const part = Py_BuildValue("(ON)",headers,emptyIfNull(data));
+				data = NULL;
+				Py_CLEAR(headers);
+				ok = part and PyList_Append(parts,part) == 0;
+				Py_XDECREF(part);
+				break;
+			}
+		}
+		
+		if(not ok)
+		{
+			Py_CLEAR(parts);
+			break;
+		}
+	}
+	
+	Py_XDECREF(headers);
+	Py_XDECREF(field);
+	Py_XDECREF(value);
+	Py_XDECREF(data);
+	return parts;
+}
+
+static bool bodyEnded(const multipart_events * const events)
+{
+	return events->length and events->events[events->length-1].type == MULTIPART_EVENT_BODY_END;
+}
+
+PyObject * multipart_parse_many(PyObject * const module, PyObject * const args, PyObject * const kwds)
+{
+	PyObject * items;
+	Py_ssize_t workers = 0;
+	static char * kwlist[] = {"items","workers",NULL};
+	
+	if(not PyArg_ParseTupleAndKeywords(args,kwds,"O|n",kwlist,&items,&workers))
+	{
+		return NULL;
+	}
+	
+	if(workers < 0)
+	{
+		PyErr_SetString(PyExc_ValueError,"workers must not be negative");
+		return NULL;
+	}
+	
+	//The workers run without the GIL, so nothing they read may change
+	//under them. A tuple copy keeps every item alive even if the caller
+	//changes items meanwhile, and each body is held through a buffer
+	//export, which keeps a bytearray from being resized.
+	PyObject * const sequence = PySequence_Tuple(items);
+	if(not sequence)
+	{
+		return NULL;
+	}
+	
+	const Py_ssize_t count = PyTuple_GET_SIZE(sequence);
+	parseBatch batch = { NULL, count, 0 };
+	PyObject * result = NULL;
+	Py_buffer * const views = PyMem_Malloc((count ? count : 1) * sizeof(Py_buffer));
+	Py_ssize_t exported = 0;
+	
+	batch.jobs = PyMem_Malloc((count ? count : 1) * sizeof(parseJob));
+	if(not batch.jobs or not views)
+	{
+		PyMem_Free(batch.jobs);
+		PyMem_Free(views);
+		Py_DECREF(sequence);
+		return PyErr_NoMemory();
+	}
+	
+	for(Py_ssize_t i = 0; i < count; i++)
+	{
+		multipart_events_init(&batch.jobs[i].events);
+		batch.jobs[i].failed = false;
+		batch.jobs[i].parsed = 0;
+	}
+	
+	for(Py_ssize_t i = 0; i < count; i++)
+	{
+		PyObject * const item = PyTuple_GET_ITEM(sequence,i);
+		parseJob * const job = &batch.jobs[i];
+		
+		if(not PyTuple_Check(item) or PyTuple_GET_SIZE(item) != 2)
+		{
+			PyErr_Format(PyExc_TypeError,"item %zd is not a (boundary, body) tuple",i);
+			goto finish;
+		}
+		
+		job->boundary = PyString_AsString(PyTuple_GET_ITEM(item,0));
+		if(not job->boundary)
+		{
+			goto finish;
+		}
+		
+		if(PyObject_GetBuffer(PyTuple_GET_ITEM(item,1),&views[i],PyBUF_SIMPLE) != 0)
+		{
+			goto finish;
+		}
+		exported += 1;
+		job->body = views[i].buf;
+		job->length = views[i].len;
+	}
+	
+	workers = workerCount(workers);
+	if(workers > count)
+	{
+		workers = count;
+	}
+	
+	runWorkers(worker,(char*)&batch,0,workers);
+	
+	result = PyList_New(count);
+	if(not result)
+	{
+		goto finish;
+	}
+	
+	for(Py_ssize_t i = 0; i < count; i++)
+	{
+		parseJob * const job = &batch.jobs[i];
+		
+		if(job->failed or job->events.failed)
+		{
+			PyErr_NoMemory();
+			Py_CLEAR(result);
+			goto finish;
+		}
+		
+		if(job->parsed != job->length or not bodyEnded(&job->events))
+		{
+			PyErr_Format(PyExc_ValueError,"item %zd is not a complete multipart body, parsing stopped at byte %zu",i,job->parsed);
+			Py_CLEAR(result);
+			goto finish;
+		}
+		
+		PyObject * const parts = multipart_parse_buildParts(&job->events);
+		if(not parts)
+		{
+			Py_CLEAR(result);
+			goto finish;
+		}
+		PyList_SET_ITEM(result,i,parts);
+	}
+	
+finish:
+	for(Py_ssize_t i = 0; i < count; i++)
+	{
+		multipart_events_free(&batch.jobs[i].events);
+	}
+	for(Py_ssize_t i = 0; i < exported; i++)
+	{
+		PyBuffer_Release(&views[i]);
+	}
+	PyMem_Free(views);
+	PyMem_Free(batch.jobs);
+	Py_DECREF(sequence);
+	return result;
+}
+
+PyObject * multipart_parse_all(PyObject * const module, PyObject * const args, PyObject * const kwds)
+{
+	parseJob job;
+	PyObject * body;
+	Py_ssize_t length;
+	static char * kwlist[] = {"boundary","body",NULL};
+	
+	if(not PyArg_ParseTupleAndKeywords(args,kwds,"sO",kwlist,&job.boundary,&body))
+	{
+		return NULL;
+	}
+	
+	if(PyObject_AsReadBuffer(body,(const void**)&job.body,&length) != 0)
+	{
+		return NULL;
+	}
+	job.length = length;
+	job.parsed = 0;
+	job.failed = false;
+	multipart_events_init(&job.events);
+	
+	//Bodies passed here are small enough that handing the GIL to other
+	//threads would cost more than the parse itself
+	runJob(&job);
+	
+	PyObject * result = NULL;
+	
+	if(job.failed or job.events.failed)
+	{
+		PyErr_NoMemory();
+	}
+	else if(job.parsed != job.length)
+	{
+		PyErr_Format(PyExc_ValueError,"input not multipart, failed on byte %zu",job.parsed);
+	}
+	else if(not bodyEnded(&job.events))
+	{
+		PyErr_SetString(PyExc_ValueError,"input ended before the closing boundary");
+	}
+	else
+	{
+		result = multipart_parse_buildParts(&job.events);
+	}
+	
+	multipart_events_free(&job.events);
+	return result;
+}
+
+//parse_parallel does not split bodies into segments smaller than this
+#define MIN_SEGMENT (1024*1024)
+
+//A slice of the body that one thread searches for delimiters
+typedef struct scanSegment {
+	char const * body;
+	size_t length;
+	char const * delimiter;
+	size_t delimiterLength;
+	
+	//Matches that start in [begin, end) belong to this segment, even if
+	//they run past end
+	size_t begin;
+	size_t end;
+	
+	//The offsets of the delimiters found, in order
+	size_t * offsets;
+	size_t count;
+	size_t size;
+	bool failed;
+} scanSegment;
+
+static void * scanWorker(void * const arg)
+{
+	scanSegment * const segment = arg;
+	const size_t stop = segment->end + segment->delimiterLength - 1 < segment->length ?
+	                    segment->end + segment->delimiterLength - 1 : segment->length;
+	char const * at = segment->body + segment->begin;
+	char const * const limit = segment->body + stop;
+	char const * found;
+	
+	while(at < limit and (found = memmem(at,limit - at,segment->delimiter,segment->delimiterLength)))
+	{
+		if(segment->count == segment->size)
+		{
+			const size_t size = segment->size ? segment->size * 2 : 64;
+			size_t * const offsets = realloc(segment->offsets,size * sizeof(size_t));
+			
+			if(not offsets)
+			{
+				segment->failed = true;
+				return NULL;
+			}
+			segment->offsets = offsets;
+			segment->size = size;
+		}
+		
+		segment->offsets[segment->count++] = found - segment->body;
+		at = found + 1;
+	}
+	
+	return NULL;
+}
+
+//The headers of one part, parsed by whichever worker claims it
+typedef struct partJob {
+	//Where the boundary line before the part starts
+	size_t begin;
+	//Where the delimiter after the part starts, which ends its data
+	size_t end;
+	//Where the data starts once the headers are parsed
+	size_t dataBegin;
+	
+	multipart_events events;
+	bool complete;
+	bool failed;
+	//Set if the boundary is followed by "--", so no part follows it
+	bool closing;
+	//Set once the part is known to start at a real delimiter rather
+	//than at bytes inside another part's headers
+	bool accepted;
+} partJob;
+
+typedef struct partBatch {
+	char const * boundary;
+	char const * body;
+	size_t length;
+	
+	partJob * jobs;
+	size_t count;
+	size_t next;
+} partBatch;
+
+//Records the end of the headers, then stops the parser there
+static int stopAtData(void * const events)
+{
+	multipart_events_settings.on_headers_complete(events);
+	return 1;
+}
+
+static void runPart(partBatch * const batch, partJob * const job)
+{
+	multipart_parser_settings settings = multipart_events_settings;
+	settings.on_headers_complete = stopAtData;
+	
+	multipart_parser * const parser = multipart_parser_init(batch->boundary,&settings);
+	
+	if(not parser)
+	{
+		job->failed = true;
+		return;
+	}
+	
+	//The parser needs to see the first byte after the headers to report
+	//them complete, which is the delimiter's CR for an empty part
+	char const * const at = batch->body + job->begin;
+	const size_t limit = job->end + 2 < batch->length ? job->end + 2 : batch->length;
+	
+	multipart_parser_set_data(parser,&job->events);
+	multipart_events_reset(&job->events,at,limit - job->begin);
+	job->dataBegin = job->begin + multipart_parser_execute(parser,at,limit - job->begin);
+	multipart_parser_free(parser);
+	
+	job->complete = job->events.length and
+	                job->events.events[job->events.length-1].type == MULTIPART_EVENT_HEADERS_COMPLETE and
+	                job->dataBegin <= job->end;
+}
+
+static void * partWorker(void * const arg)
+{
+	partBatch * const batch = arg;
+	size_t index;
+	
+	while((index = __sync_fetch_and_add(&batch->next,1)) < batch->count)
+	{
+		if(not batch->jobs[index].closing)
+		{
+			runPart(batch,&batch->jobs[index]);
+		}
+	}
+	
+	return NULL;
+}
+
+//Finds every delimiter in the body, using one thread per segment.
+//Returns the number found, or -1 with an exception set.
+static Py_ssize_t findDelimiters(char const * const boundary, char const * const body, size_t const length, Py_ssize_t const workers, size_t ** const offsets)
+{
+	const size_t boundaryLength = strlen(boundary);
+	char * const delimiter = PyMem_Malloc(boundaryLength + 2);
+	scanSegment * const segments = PyMem_Malloc(workers * sizeof(scanSegment));
+	Py_ssize_t count = -1;
+	
+	if(not delimiter or not segments)
+	{
+		PyErr_NoMemory();
+		goto finish;
+	}
+	
+	delimiter[0] = '\r';
+	delimiter[1] = '\n';
+	memcpy(delimiter + 2,boundary,boundaryLength);
+	
+	for(Py_ssize_t i = 0; i < workers; i++)
+	{
+		scanSegment * const segment = &segments[i];
+		
+		memset(segment,0,sizeof(*segment));
+		segment->body = body;
+		segment->length = length;
+		segment->delimiter = delimiter;
+		segment->delimiterLength = boundaryLength + 2;
+		segment->begin = length / workers * i;
+		segment->end = i + 1 == workers ? length : length / workers * (i + 1);
+	}
+	
+	runWorkers(scanWorker,(char*)segments,sizeof(scanSegment),workers);
+	
+	size_t total = 0;
+	for(Py_ssize_t i = 0; i < workers; i++)
+	{
+		if(segments[i].failed)
+		{
+			PyErr_NoMemory();
+			goto finish;
+		}
+		total += segments[i].count;
+	}
+	
+	//Segments are in body order, so stitching them keeps the offsets
+	//sorted
+	*offsets = PyMem_Malloc((total ? total : 1) * sizeof(size_t));
+	if(not *offsets)
+	{
+		PyErr_NoMemory();
+		goto finish;
+	}
+	
+	count = 0;
+	for(Py_ssize_t i = 0; i < workers; i++)
+	{
+		memcpy(*offsets + count,segments[i].offsets,segments[i].count * sizeof(size_t));
+		count += segments[i].count;
+	}
+	
+finish:
+	if(segments)
+	{
+		for(Py_ssize_t i = 0; i < workers; i++)
+		{
+			free(segments[i].offsets);
+		}
+	}
+	PyMem_Free(segments);
+	PyMem_Free(delimiter);
+	return count;
+}
+
+PyObject * multipart_parse_parallel(PyObject * const module, PyObject * const args, PyObject * const kwds)
+{
+	char const * boundary;
+	PyObject * body;
+	Py_ssize_t workers = 0;
+	static char * kwlist[] = {"boundary","body","workers",NULL};
+	
+	if(not PyArg_ParseTupleAndKeywords(args,kwds,"sO|n",kwlist,&boundary,&body,&workers))
+	{
+		return NULL;
+	}
+	
+	if(workers < 0)
+	{
+		PyErr_SetString(PyExc_ValueError,"workers must not be negative");
+		return NULL;
+	}
+	
+	//Held as an export while the workers read it without the GIL, which
+	//keeps a bytearray from being resized under them
+	Py_buffer view;
+	if(PyObject_GetBuffer(body,&view,PyBUF_SIMPLE) != 0)
+	{
+		return NULL;
+	}
+	char const * const data = view.buf;
+	const size_t length = view.len;
+	
+	workers = workerCount(workers);
+	if(workers > (Py_ssize_t)(length / MIN_SEGMENT))
+	{
+		workers = length / MIN_SEGMENT;
+	}
+	if(workers < 1)
+	{
+		workers = 1;
+	}
+	
+	size_t * delimiters = NULL;
+	const Py_ssize_t found = findDelimiters(boundary,data,length,workers,&delimiters);
+	if(found < 0)
+	{
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+	
+	//The first part follows the boundary at the start of the body, each
+	//other one the delimiter before it. A delimiter followed by "--"
+	//closes the body.
+	const size_t boundaryLength = strlen(boundary);
+	partBatch batch = { boundary, data, length, NULL, 0, 0 };
+	PyObject * result = NULL;
+	size_t parts = 0;
+	
+	batch.jobs = PyMem_Malloc((found + 1) * sizeof(partJob));
+	if(not batch.jobs)
+	{
+		PyMem_Free(delimiters);
+		PyBuffer_Release(&view);
+		return PyErr_NoMemory();
+	}
+	
+	for(Py_ssize_t k = 0; k <= found; k++)
+	{
+		const size_t begin = k ? delimiters[k-1] + 2 : 0;
+		const size_t after = begin + boundaryLength;
+		
+		//Without a delimiter after it, the last part runs to the end of
+		//the body and only its headers are checked
+		partJob * const job = &batch.jobs[batch.count++];
+		memset(job,0,sizeof(*job));
+		job->begin = begin;
+		job->end = k < found ? delimiters[k] : length;
+		job->closing = k and after + 2 <= length and data[after] == '-' and data[after+1] == '-';
+	}
+	PyMem_Free(delimiters);
+	
+	runWorkers(partWorker,(char*)&batch,0,workers < (Py_ssize_t)batch.count ? workers : (Py_ssize_t)batch.count);
+	
+	//The search does not know where headers are, so a match can also be
+	//a CRLF inside a part's headers, such as the one ending them when the
+	//data starts with the boundary. Walking the parts in order skips
+	//every match before the data of the part it falls in. A part whose
+	//headers were cut short by such a match is parsed again up to the
+	//end of the body.
+	size_t k = 0;
+	while(true)
+	{
+		partJob * const job = &batch.jobs[k];
+		
+		if(not job->complete and not job->failed and not job->events.failed)
+		{
+			job->end = length;
+			runPart(&batch,job);
+		}
+		
+		if(job->failed or job->events.failed)
+		{
+			PyErr_NoMemory();
+			goto finish;
+		}
+		
+		//Headers that run into the end of the body are missing the
+		//closing boundary
+		if(not job->complete)
+		{
+			if(job->dataBegin < length)
+			{
+				PyErr_Format(PyExc_ValueError,"input not multipart, failed on byte %zu",job->dataBegin);
+			}
+			else
+			{
+				PyErr_SetString(PyExc_ValueError,"input ended before the closing boundary");
+			}
+			goto finish;
+		}
+		
+		job->accepted = true;
+		parts += 1;
+		
+		//The delimiter of a match starts 2 bytes before its part
+		do
+		{
+			k += 1;
+		}while(k < batch.count and batch.jobs[k].begin - 2 < job->dataBegin);
+		
+		if(k == batch.count)
+		{
+			PyErr_SetString(PyExc_ValueError,"input ended before the closing boundary");
+			goto finish;
+		}
+		
+		job->end = batch.jobs[k].begin - 2;
+		if(batch.jobs[k].closing)
+		{
+			break;
+		}
+		
+		//A hyphen after a delimiter can only start the closing "--"
+		const size_t after = batch.jobs[k].begin + boundaryLength;
+		if(after < length and data[after] == '-')
+		{
+			if(after + 1 < length)
+			{
+				PyErr_Format(PyExc_ValueError,"input not multipart, failed on byte %zu",after + 1);
+			}
+			else
+			{
+				PyErr_SetString(PyExc_ValueError,"input ended before the closing boundary");
+			}
+			goto finish;
+		}
+	}
+	
+	result = PyList_New(parts);
+	if(not result)
+	{
+		goto finish;
+	}
+	
+	for(size_t i = 0, added = 0; i < batch.count; i++)
+	{
+		partJob * const job = &batch.jobs[i];
+		
+		if(not job->accepted)
+		{
+			continue;
+		}
+		
+		PyObject * headers = PyList_New(0);
+		PyObject * field = NULL;
+		PyObject * value = NULL;
+		bool ok = headers != NULL;
+		
+		for(size_t e = 0; ok and e < job->events.length; e++)
+		{
+			const multipart_event * const event = &job->events.events[e];
+			
+			if(event->type == MULTIPART_EVENT_HEADER_FIELD or
+			   event->type == MULTIPART_EVENT_HEADER_VALUE or
+			   event->type == MULTIPART_EVENT_HEADER_VALUE_END)
+			{
+				ok = headerEvent(headers,&field,&value,event,multipart_event_data(&job->events,event));
+			}
+		}
+		Py_XDECREF(field);
+		Py_XDECREF(value);
+		
+		//The data is a view of the body, not a copy
+		PyObject * const view = ok ? PyBuffer_FromObject(body,job->dataBegin,job->end - job->dataBegin) : NULL;
+		PyObject * const part = view ? PyTuple_Pack(2,headers,view) : NULL;
+		Py_XDECREF(headers);
+		Py_XDECREF(view);
+		if(not part)
+		{
+			Py_CLEAR(result);
+			goto finish;
+		}
+		PyList_SET_ITEM(result,added++,part);
+	}
+	
+finish:
+	for(size_t i = 0; i < batch.count; i++)
+	{
+		multipart_events_free(&batch.jobs[i].events);
+	}
+	PyMem_Free(batch.jobs);
+	PyBuffer_Release(&view);
+	return result;
+}
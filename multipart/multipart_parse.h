@@ -0,0 +1,22 @@
+#include <Python.h>
+
+#ifndef __multipart_parse
+#define __multipart_parse
+
+#include "multipart_events.h"
+
+//Builds a list of (headers, data) tuples from the events recorded while
+//parsing a whole body, where headers is a list of (name, value) tuples
+//and data is a string. Returns NULL with an exception set on failure.
+PyObject * multipart_parse_buildParts(const multipart_events * events);
+
+//multipart.parse_all(boundary, body)
+PyObject * multipart_parse_all(PyObject * module, PyObject * args, PyObject * kwds);
+
+//multipart.parse_many(items, workers=0)
+PyObject * multipart_parse_many(PyObject * module, PyObject * args, PyObject * kwds);
+
+//multipart.parse_parallel(boundary, body, workers=0)
+PyObject * multipart_parse_parallel(PyObject * module, PyObject * args, PyObject * kwds);
+
+#endif
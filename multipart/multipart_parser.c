@@ -11,6 +11,11 @@
 #include <ctype.h>
 #include "iso646.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MULTIPART_X86_DISPATCH
+#endif
+
 static void multipart_log(const char * format, ...)
 {
 #ifdef DEBUG_MULTIPART
@@ -41,10 +46,23 @@ do {                                                                   \
   }                                                                    \
 } while (0)
 
+/* Like EMIT_DATA_CB, but empty spans are not reported */
+#define EMIT_SPAN_CB(FOR, ptr, len)                                    \
+do {                                                                   \
+  if ((len) > 0) {                                                     \
+    EMIT_DATA_CB(FOR, ptr, len);                                       \
+  }                                                                    \
+} while (0)
 
 #define LF 10
 #define CR 13
 
+/* Returns the offset of the first CR in buf that could begin
+ * "\r\n<boundary>", or len if there is none. A CR too close to the
+ * end of buf to be ruled out counts as a candidate.
+ */
+typedef size_t (*multipart_scan_fn) (const char *buf, size_t len, char first);
+
 struct multipart_parser {
   void * data;
 
@@ -55,6 +73,29 @@ struct multipart_parser {
 
   const multipart_parser_settings* settings;
 
+  multipart_scan_fn scan;
+  enum multipart_search search;
+  int coalesce;
+
+  int pause_requested;
+  int paused;
+
+  multipart_parser_limits limits;
+  enum multipart_limit exceeded;
+  //Bytes parsed by earlier calls to multipart_parser_execute
+  size_t total_bytes;
+  size_t parts;
+  size_t headers;
+  size_t header_bytes;
+  //Offset in the body at which the data of the current part begins
+  size_t part_data_offset;
+
+  //Horspool shift for each byte value, relative to the last byte of a
+  //window the size of the delimiter
+  size_t skip[256];
+  //"\r\n" followed by the boundary
+  char* delimiter;
+
   char* lookbehind;
   char multipart_boundary[1];
 };
@@ -79,13 +120,119 @@ enum state {
   s_end
 };
 
+static size_t multipart_scan_scalar(const char *buf, size_t len, char first) {
+  const char * const end = buf + len;
+  const char * at = buf;
+
+  while ((at = memchr(at, CR, end - at)) != NULL) {
+    if (at + 1 == end or (at[1] == LF and (at + 2 == end or at[2] == first))) {
+      return at - buf;
+    }
+    ++ at;
+  }
+  return len;
+}
+
+#ifdef MULTIPART_X86_DISPATCH
+//Compares each byte, the byte after it and the one after that against
+//CR, LF and the first boundary byte in one pass, so a CR that merely
+//appears inside binary data does not stop the scan.
+__attribute__((target("sse2")))
+static size_t multipart_scan_sse2(const char *buf, size_t len, char first) {
+  const __m128i cr = _mm_set1_epi8(CR);
+  const __m128i lf = _mm_set1_epi8(LF);
+  const __m128i b0 = _mm_set1_epi8(first);
+  size_t i = 0;
+
+  for (; i + 2 + sizeof(__m128i) <= len; i += sizeof(__m128i)) {
+    const __m128i v0 = _mm_loadu_si128((const __m128i*)(buf + i));
+    const __m128i v1 = _mm_loadu_si128((const __m128i*)(buf + i + 1));
+    const __m128i v2 = _mm_loadu_si128((const __m128i*)(buf + i + 2));
+    const int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(v0, cr),
+                      _mm_and_si128(_mm_cmpeq_epi8(v1, lf),
+                                    _mm_cmpeq_epi8(v2, b0))));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + multipart_scan_scalar(buf + i, len - i, first);
+}
+
+__attribute__((target("avx2")))
+static size_t multipart_scan_avx2(const char *buf, size_t len, char first) {
+  const __m256i cr = _mm256_set1_epi8(CR);
+  const __m256i lf = _mm256_set1_epi8(LF);
+  const __m256i b0 = _mm256_set1_epi8(first);
+  size_t i = 0;
+
+  for (; i + 2 + sizeof(__m256i) <= len; i += sizeof(__m256i)) {
+    const __m256i v0 = _mm256_loadu_si256((const __m256i*)(buf + i));
+    const __m256i v1 = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+    const __m256i v2 = _mm256_loadu_si256((const __m256i*)(buf + i + 2));
+    const unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(v0, cr),
+                         _mm256_and_si256(_mm256_cmpeq_epi8(v1, lf),
+                                          _mm256_cmpeq_epi8(v2, b0))));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + multipart_scan_sse2(buf + i, len - i, first);
+}
+#endif
+
+static multipart_scan_fn multipart_select_scan(void) {
+#ifdef MULTIPART_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return multipart_scan_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return multipart_scan_sse2;
+  }
+#endif
+  return multipart_scan_scalar;
+}
+
+static void multipart_build_skip_table(multipart_parser* p) {
+  const size_t m = p->boundary_length + 2;
+  size_t k;
+
+  for (k = 0; k < 256; k++) {
+    p->skip[k] = m;
+  }
+  for (k = 0; k + 1 < m; k++) {
+    p->skip[(unsigned char) p->delimiter[k]] = m - 1 - k;
+  }
+}
+
+//Returns the offset of the first full delimiter in buf. When there is
+//none, returns the first candidate CR in the tail that is too short to
+//hold a delimiter, or len.
+static size_t multipart_search_horspool(const multipart_parser* p, const char *buf, size_t len) {
+  const size_t m = p->boundary_length + 2;
+  const char last = p->delimiter[m - 1];
+  size_t j = 0;
+
+  while (j + m <= len) {
+    const char c = buf[j + m - 1];
+    if (c == last and memcmp(buf + j, p->delimiter, m - 1) == 0) {
+      return j;
+    }
+    j += p->skip[(unsigned char) c];
+  }
+  return j + p->scan(buf + j, len - j, p->multipart_boundary[0]);
+}
+
 multipart_parser* multipart_parser_init
     (const char *boundary, const multipart_parser_settings* settings) {
 
   const int boundaryLength = strlen(boundary);
   multipart_parser* p = malloc(sizeof(multipart_parser) +
                                boundaryLength +
-                               boundaryLength + 9);
+                               boundaryLength + 9 +
+                               boundaryLength + 2);
 
   if(p)
   {
@@ -93,10 +240,28 @@ multipart_parser* multipart_parser_init
 	  p->boundary_length = boundaryLength;
 	  
 	  p->lookbehind = (p->multipart_boundary + p->boundary_length + 1);
+	  p->delimiter = (p->lookbehind + p->boundary_length + 8);
+	  p->delimiter[0] = CR;
+	  p->delimiter[1] = LF;
+	  memcpy(p->delimiter + 2, boundary, boundaryLength);
+	  multipart_build_skip_table(p);
 
 	  p->index = 0;
 	  p->state = s_start;
 	  p->settings = settings;
+	  p->scan = multipart_select_scan();
+	  p->search = MULTIPART_SEARCH_SCAN;
+	  p->coalesce = 0;
+	  p->pause_requested = 0;
+	  p->paused = 0;
+
+	  memset(&p->limits, 0, sizeof(p->limits));
+	  p->exceeded = MULTIPART_LIMIT_NONE;
+	  p->total_bytes = 0;
+	  p->parts = 0;
+	  p->headers = 0;
+	  p->header_bytes = 0;
+	  p->part_data_offset = 0;
   }
 
   return p;
@@ -114,16 +279,113 @@ void *multipart_parser_get_data(multipart_parser *p) {
     return p->data;
 }
 
+void multipart_parser_set_search(multipart_parser *p, enum multipart_search search) {
+    p->search = search;
+}
+
+void multipart_parser_set_coalesce(multipart_parser *p, int coalesce) {
+    p->coalesce = coalesce;
+}
+
+void multipart_parser_pause(multipart_parser *p) {
+    p->pause_requested = 1;
+}
+
+int multipart_parser_paused(const multipart_parser *p) {
+    return p->paused;
+}
+
+void multipart_parser_set_limits(multipart_parser *p, const multipart_parser_limits *limits) {
+    p->limits = *limits;
+}
+
+enum multipart_limit multipart_parser_limit_exceeded(const multipart_parser *p) {
+    return p->exceeded;
+}
+
+const char * multipart_limit_name(enum multipart_limit limit) {
+  switch (limit) {
+    case MULTIPART_LIMIT_HEADER_BYTES: return "max_header_bytes";
+    case MULTIPART_LIMIT_HEADERS_PER_PART: return "max_headers_per_part";
+    case MULTIPART_LIMIT_PARTS: return "max_parts";
+    case MULTIPART_LIMIT_PART_BYTES: return "max_part_bytes";
+    case MULTIPART_LIMIT_TOTAL_BYTES: return "max_total_bytes";
+    default: return NULL;
+  }
+}
+
+#define EXCEED(LIMIT, AT)                                              \
+do {                                                                   \
+  p->exceeded = (LIMIT);                                               \
+  return (AT);                                                         \
+} while (0)
+
+/* Counts a new part against max_parts and starts counting its headers */
+#define BEGIN_PART()                                                   \
+do {                                                                   \
+  if (p->limits.max_parts and ++ p->parts > p->limits.max_parts) {    \
+    EXCEED(MULTIPART_LIMIT_PARTS, i);                                  \
+  }                                                                    \
+  p->headers = 0;                                                      \
+  p->header_bytes = 0;                                                 \
+} while (0)
+
+static size_t multipart_parser_run(multipart_parser* p, const char *buf, size_t len);
+
 //Returns number of bytes parsed
 size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len) {
+  p->paused = 0;
+  if (p->exceeded) {
+    return 0;
+  }
+
+  //The body is cut short where max_total_bytes runs out
+  size_t allowed = len;
+  if (p->limits.max_total_bytes and len > p->limits.max_total_bytes - p->total_bytes) {
+    allowed = p->limits.max_total_bytes - p->total_bytes;
+  }
+
+  size_t parsed = multipart_parser_run(p, buf, allowed);
+
+  if (allowed < len and parsed == allowed and not p->exceeded and not p->paused) {
+    if (p->state == s_end) {
+      //Whatever follows the closing boundary is ignored anyway
+      parsed = len;
+    } else {
+      p->exceeded = MULTIPART_LIMIT_TOTAL_BYTES;
+    }
+  }
+
+  p->total_bytes += parsed;
+  return parsed;
+}
+
+static size_t multipart_parser_run(multipart_parser* p, const char *buf, size_t len) {
   size_t i = 0;
   size_t mark = 0;
   char c;
   int is_last = 0;
 
+  if (len == 0) {
+    return 0;
+  }
+
   while(!is_last) {
+    //Pausing makes the next byte the last one of the buffer, so any span
+    //still pending is reported the same way as at the end of a buffer
+    if (p->pause_requested) {
+      p->pause_requested = 0;
+      p->paused = 1;
+      len = i + 1;
+    }
     c = buf[i];
     is_last = (i == (len - 1));
+    //Every byte from the first header to the blank line after the last
+    //counts against max_header_bytes
+    if (p->state >= s_header_field_start and p->state <= s_header_value_almost_done and
+        p->limits.max_header_bytes and ++ p->header_bytes > p->limits.max_header_bytes) {
+      EXCEED(MULTIPART_LIMIT_HEADER_BYTES, i);
+    }
     switch (p->state) {
       case s_start:
         multipart_log("s_start");
@@ -146,6 +408,7 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
             return i;
           }
           p->index = 0;
+          BEGIN_PART();
           NOTIFY_CB(part_data_begin);
           p->state = s_header_field_start;
           break;
@@ -179,6 +442,9 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
         }
 
         if (c == ':') {
+          if (p->limits.max_headers_per_part and ++ p->headers > p->limits.max_headers_per_part) {
+            EXCEED(MULTIPART_LIMIT_HEADERS_PER_PART, i);
+          }
           EMIT_DATA_CB(header_field, buf + mark, i - mark);
           p->state = s_header_value_start;
           break;
@@ -218,6 +484,7 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
         if (c == CR) {
           EMIT_DATA_CB(header_value, buf + mark, i - mark);
           p->state = s_header_value_almost_done;
+          break;
         }
         if (is_last)
         {
@@ -238,20 +505,56 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
         multipart_log("s_part_data_start");
         NOTIFY_CB(headers_complete);
         mark = i;
+        p->part_data_offset = p->total_bytes + i;
         p->state = s_part_data;
 
       /* fallthrough */
       case s_part_data:
         multipart_log("s_part_data");
-        if (c == CR) {
-            EMIT_DATA_CB(part_data, buf + mark, i - mark);
-            mark = i;
-            p->state = s_part_data_almost_boundary;
-            p->lookbehind[0] = CR;
+        //Skip straight to the next CR that could start a delimiter,
+        //everything before it is part data
+        if (p->search == MULTIPART_SEARCH_HORSPOOL) {
+          i += multipart_search_horspool(p, buf + i, len - i);
+        } else {
+          i += p->scan(buf + i, len - i, p->multipart_boundary[0]);
+        }
+        //Everything up to here is data of the part, even if i ends up
+        //at a CR that begins the delimiter
+        if (p->limits.max_part_bytes and
+            p->total_bytes + i - p->part_data_offset > p->limits.max_part_bytes) {
+          const size_t limit_at = p->part_data_offset + p->limits.max_part_bytes;
+          EXCEED(MULTIPART_LIMIT_PART_BYTES, limit_at > p->total_bytes ? limit_at - p->total_bytes : 0);
+        }
+        if (i == len) {
+            i = len - 1;
+            is_last = 1;
+            EMIT_SPAN_CB(part_data, buf + mark, len - mark);
             break;
         }
-        if (is_last)
-            EMIT_DATA_CB(part_data, buf + mark, (i - mark) + 1);
+        is_last = (i == (len - 1));
+        //A full delimiter inside this buffer ends the part without
+        //walking the boundary states byte by byte
+        if (i + p->boundary_length + 2 <= len and
+            memcmp(buf + i, p->delimiter, p->boundary_length + 2) == 0) {
+            EMIT_SPAN_CB(part_data, buf + mark, i - mark);
+            NOTIFY_CB(part_data_end);
+            p->state = s_part_data_almost_end;
+            i += p->boundary_length + 1;
+            is_last = (i == (len - 1));
+            break;
+        }
+        p->state = s_part_data_almost_boundary;
+        p->lookbehind[0] = CR;
+        if (p->coalesce) {
+            //The CR stays part of the pending span until it is known
+            //not to start a delimiter
+            if (is_last) {
+                EMIT_SPAN_CB(part_data, buf + mark, i - mark);
+            }
+            break;
+        }
+        EMIT_SPAN_CB(part_data, buf + mark, i - mark);
+        mark = i;
         break;
 
       case s_part_data_almost_boundary:
@@ -260,23 +563,47 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
             p->state = s_part_data_boundary;
             p->lookbehind[1] = LF;
             p->index = 0;
+            if (p->coalesce and is_last and i >= 1) {
+                EMIT_SPAN_CB(part_data, buf + mark, (i - 1) - mark);
+            }
             break;
         }
-        EMIT_DATA_CB(part_data, p->lookbehind, 1);
         p->state = s_part_data;
+        if (p->coalesce and i >= 1) {
+            //The CR came from this buffer, so the span from mark simply
+            //continues through it
+            i --;
+            is_last = 0;
+            break;
+        }
+        EMIT_DATA_CB(part_data, p->lookbehind, 1);
         mark = i --;
+        is_last = 0;
         break;
 
       case s_part_data_boundary:
         multipart_log("s_part_data_boundary");
         if (p->multipart_boundary[p->index] != c) {
-          EMIT_DATA_CB(part_data, p->lookbehind, 2 + p->index);
           p->state = s_part_data;
+          if (p->coalesce and i >= 2 + p->index) {
+            i --;
+            is_last = 0;
+            break;
+          }
+          EMIT_DATA_CB(part_data, p->lookbehind, 2 + p->index);
           mark = i --;
+          is_last = 0;
           break;
         }
         p->lookbehind[2 + p->index] = c;
-        if ((++ p->index) == p->boundary_length) {
+        ++ p->index;
+        //With coalescing, the data before the delimiter is still
+        //pending if the delimiter started in this buffer
+        if (p->coalesce and (p->index == p->boundary_length or is_last) and
+            i + 1 >= 2 + p->index) {
+            EMIT_SPAN_CB(part_data, buf + mark, (i + 1 - (2 + p->index)) - mark);
+        }
+        if (p->index == p->boundary_length) {
             NOTIFY_CB(part_data_end);
             p->state = s_part_data_almost_end;
         }
@@ -307,6 +634,7 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
         multipart_log("s_part_data_end");
         if (c == LF) {
             p->state = s_header_field_start;
+            BEGIN_PART();
             NOTIFY_CB(part_data_begin);
             break;
         }
@@ -323,5 +651,10 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
     ++ i;
   }
 
+  //A pause asked for on the last byte leaves nothing to hold back
+  if (p->pause_requested) {
+    p->pause_requested = 0;
+    p->paused = 1;
+  }
   return len;
 }
@@ -17,6 +17,12 @@ typedef struct multipart_parser multipart_parser;
 typedef struct multipart_parser_settings multipart_parser_settings;
 typedef struct multipart_parser_state multipart_parser_state;
 
+/* How s_part_data looks for the next "\r\n<boundary>" delimiter */
+enum multipart_search {
+  MULTIPART_SEARCH_SCAN = 0, /* vectorized scan for the next candidate CR */
+  MULTIPART_SEARCH_HORSPOOL  /* Boyer-Moore-Horspool skip over the body */
+};
+
 typedef int (*multipart_data_cb) (void*, const char *at, size_t length);
 typedef int (*multipart_notify_cb) (void*);
 
@@ -42,6 +48,52 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
 void multipart_parser_set_data(multipart_parser* p, void* data);
 void * multipart_parser_get_data(multipart_parser* p);
 
+void multipart_parser_set_search(multipart_parser* p, enum multipart_search search);
+
+/* When non-zero, on_part_data is only called for spans known not to
+ * hold a delimiter: a CR that turns out to be data does not split the
+ * span, and each call covers as much of the input buffer as possible.
+ */
+void multipart_parser_set_coalesce(multipart_parser* p, int coalesce);
+
+/* Asks the parser to stop one byte after the current one, normally from
+ * within a callback. multipart_parser_execute then returns early with
+ * every span before that point reported, and multipart_parser_paused is
+ * non-zero until the next call, which carries on from the byte after.
+ */
+void multipart_parser_pause(multipart_parser* p);
+int multipart_parser_paused(const multipart_parser* p);
+
+/* Limits on what one body may hold. Zero means no limit. */
+typedef struct multipart_parser_limits {
+  size_t max_header_bytes;     /* bytes of the header block of a part */
+  size_t max_headers_per_part;
+  size_t max_parts;
+  size_t max_part_bytes;       /* data bytes of a part */
+  size_t max_total_bytes;      /* bytes of the whole body */
+} multipart_parser_limits;
+
+enum multipart_limit {
+  MULTIPART_LIMIT_NONE = 0,
+  MULTIPART_LIMIT_HEADER_BYTES,
+  MULTIPART_LIMIT_HEADERS_PER_PART,
+  MULTIPART_LIMIT_PARTS,
+  MULTIPART_LIMIT_PART_BYTES,
+  MULTIPART_LIMIT_TOTAL_BYTES
+};
+
+/* Once a limit is exceeded, multipart_parser_execute returns the offset
+ * at which that happened without reporting anything past it, and parses
+ * nothing more afterwards.
+ */
+void multipart_parser_set_limits(multipart_parser* p, const multipart_parser_limits* limits);
+
+/* The limit that stopped the parser, or MULTIPART_LIMIT_NONE */
+enum multipart_limit multipart_parser_limit_exceeded(const multipart_parser* p);
+
+/* The name of the option that sets a limit, e.g. "max_parts" */
+const char * multipart_limit_name(enum multipart_limit limit);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -5,11 +5,19 @@ sources = [
     'multipart/multipart_parser.c',
     'multipart/multipart.c',
     'multipart/multipart_Parser.c',
-    'multipart/multipart_Generator.c'
+    'multipart/multipart_Generator.c',
+    'multipart/multipart_events.c',
+    'multipart/multipart_parse.c',
+    'multipart/multipart_digest.c',
+    'multipart/multipart_decode.c',
+    'multipart/multipart_Headers.c',
+    'multipart/multipart_PushParser.c',
+    'multipart/multipart_Encoder.c'
 ]
 
 multipart = Extension('multipart', sources=sources,
-                      extra_compile_args=['-std=gnu99', '-O0'])
+                      extra_compile_args=['-std=gnu99', '-O3', '-pthread'],
+                      extra_link_args=['-pthread'])
 
 setup(
     name='multipart',
@@ -2,8 +2,20 @@
 
 import multipart
 import unittest
+import base64
+import binascii
 import hashlib
+import io
+import os
 import random
+import tempfile
+import StringIO
+import sys
+
+
+def chunked(body, size):
+    for offset in range(0, len(body), size):
+        yield body[offset:offset + size]
 
 
 class TestMultipart(unittest.TestCase):
@@ -245,6 +257,617 @@ class TestMultipart(unittest.TestCase):
             raw_data = ''.join([d for d in data])
             assert raw_data == expected[1]
 
+    def test_part_data_with_carriage_returns(self):
+        boundary = '--faKe_BoundaRy'
+        payloads = ['\r' * 40 + 'x\r\n-' + '\r\n--faKe' + '\r\n' * 20,
+                    ''.join(chr(i % 256) for i in range(5000)) + '\r\n--',
+                    '']
+        body = ''.join('%s\r\nContent-Type: a\r\n\r\n%s\r\n' % (boundary, p)
+                       for p in payloads) + boundary + '--'
+
+        for size in (1, 2, 3, 7, 33, 64, 1000, len(body)):
+            for search in ('scan', 'horspool'):
+                for min_chunk in (0, 1, 4096):
+                    parts = [''.join(data) for _, data in multipart.Parser(
+                        boundary, chunked(body, size), search=search,
+                        min_chunk=min_chunk)]
+                    self.assertEqual(parts, payloads)
+
+    def test_no_empty_part_data(self):
+        boundary = '--faKe_BoundaRy'
+        payloads = ['\r\r\nx\r\r', '\r\n--faKe\r\n-', '\r']
+        body = ''.join('%s\r\n\r\n%s\r\n' % (boundary, p)
+                       for p in payloads) + boundary + '--'
+
+        for size in (1, 2, 5, len(body)):
+            for search in ('scan', 'horspool'):
+                parts = [list(data) for _, data in multipart.Parser(
+                    boundary, chunked(body, size), search=search)]
+                self.assertEqual([''.join(p) for p in parts], payloads)
+                self.assertFalse(any('' in chunks for chunks in parts))
+
+    def test_coalesced_part_data(self):
+        boundary = '--faKe_BoundaRy'
+        payload = 'ab\rcd\r\nef\r\n-gh\r\n--faKe\r' * 100
+        body = '%s\r\n\r\n%s\r\n%s--' % (boundary, payload, boundary)
+
+        chunks = [data for _, data in multipart.Parser(boundary, [body],
+                                                        min_chunk=1)]
+        self.assertEqual(list(chunks[0]), [payload])
+
+        for _, data in multipart.Parser(boundary, chunked(body, 7),
+                                        min_chunk=64):
+            chunks = list(data)
+            self.assertEqual(''.join(chunks), payload)
+            self.assertTrue(all(len(chunk) >= 64 for chunk in chunks[:-1]))
+
+    def test_horspool_search(self):
+        boundary = '------------------------------8f9710048d91'
+        for part, expected in zip(
+                multipart.Parser(boundary, open('tests/fake_stream1.txt'),
+                                 search='horspool'),
+                multipart.Parser(boundary, open('tests/fake_stream1.txt'))):
+            self.assertEqual(''.join(part[1]), ''.join(expected[1]))
+
+        self.assertRaises(ValueError, multipart.Parser, boundary, '',
+                          search='bytewise')
+
+    def test_zero_copy_part_data(self):
+        boundary = '------------------------------8f9710048d91'
+        expected = [''.join(data) for _, data in
+                    multipart.Parser(boundary, open('tests/fake_stream1.txt'))]
+
+        body = open('tests/fake_stream1.txt').read()
+        for size in (5, 100, 100000):
+            parts = []
+            for _, data in multipart.Parser(boundary, chunked(body, size),
+                                            min_chunk=1, zero_copy=True):
+                chunks = list(data)
+                if size == 100000:
+                    self.assertTrue(all(isinstance(chunk, buffer)
+                                        for chunk in chunks))
+                parts.append(''.join(str(chunk) for chunk in chunks))
+            self.assertEqual(parts, expected)
+
+    def test_block_reads(self):
+        boundary = '------------------------------8f9710048d91'
+        body = open('tests/fake_stream1.txt').read()
+        expected = [''.join(data) for _, data in
+                    multipart.Parser(boundary, iter([body]))]
+
+        for block_size in (1, 7, 4096, 1 << 20):
+            for fin in (io.BytesIO(body), StringIO.StringIO(body),
+                        open('tests/fake_stream1.txt', 'rb')):
+                parts = [''.join(str(d) for d in data) for _, data in
+                         multipart.Parser(boundary, fin, block_size=block_size,
+                                          zero_copy=True)]
+                self.assertEqual(parts, expected)
+
+        self.assertRaises(ValueError, multipart.Parser, boundary,
+                          io.BytesIO(body), block_size=-1)
+
+        # Reading stops at content_length, so trailing bytes are not read
+        for fin in (io.BytesIO(body + 'trailing'),
+                    StringIO.StringIO(body + 'trailing')):
+            parts = [''.join(data) for _, data in
+                     multipart.Parser(boundary, fin, block_size=1000,
+                                      content_length=len(body))]
+            self.assertEqual(parts, expected)
+            self.assertEqual(fin.read(), 'trailing')
+
+    def test_truncated_input(self):
+        boundary = '------------------------------8f9710048d91'
+        body = open('tests/fake_stream1.txt').read()
+
+        def consume():
+            for _, data in multipart.Parser(boundary, io.BytesIO(body[:-100])):
+                list(data)
+
+        self.assertRaises(ValueError, consume)
+
+    def test_max_buffer(self):
+        boundary = '--faKe_BoundaRy'
+        payload = 'x' * 100000
+        body = ''.join('%s\r\nContent-Type: a\r\n\r\n%s\r\n' % (boundary, payload)
+                       for _ in range(3)) + boundary + '--'
+
+        def parser():
+            return multipart.Parser(boundary, io.BytesIO(body),
+                                    block_size=4096, max_buffer=10000)
+
+        # Reading each part in turn stays within the limit
+        self.assertEqual([''.join(data) for _, data in parser()],
+                         [payload] * 3)
+
+        # Holding on to unread data while advancing cannot be drained
+        def skip():
+            return [data for _, data in parser()]
+
+        self.assertRaises(BufferError, skip)
+
+        # Iterators the consumer dropped are not buffered at all
+        it = parser()
+        for _ in range(3):
+            next(it)
+        self.assertRaises(StopIteration, next, it)
+
+        # Once iteration ends, no part's iterators keep the parser alive
+        it = parser()
+        for headers, data in it:
+            ''.join(data)
+        del headers, data
+        self.assertEqual(sys.getrefcount(it), 2)
+
+        # Without the GIL a whole block is parsed before any of its data is
+        # queued, which the cap could not hold to
+        self.assertRaises(ValueError, multipart.Parser, boundary,
+                          io.BytesIO(body), max_buffer=10000, release_gil=True)
+
+    def test_max_buffer_pauses_within_chunk(self):
+        boundary = '--faKe_BoundaRy'
+        payloads = [os.urandom(50000) for _ in range(3)]
+        body = ''.join('%s\r\nContent-Type: a\r\n\r\n%s\r\n' % (boundary, p)
+                       for p in payloads) + boundary + '--'
+
+        # The parser stops part way through the single chunk once
+        # max_buffer is queued, and carries on as the data is read
+        for min_chunk in (0, 1000):
+            for fin in (iter([body]), io.BytesIO(body)):
+                parser = multipart.Parser(boundary, fin, block_size=len(body),
+                                          max_buffer=10000, min_chunk=min_chunk)
+                self.assertEqual([''.join(data) for _, data in parser],
+                                 payloads)
+
+        def skip():
+            return [data for _, data in multipart.Parser(
+                boundary, iter([body]), max_buffer=10000)]
+
+        self.assertRaises(BufferError, skip)
+
+    def test_spool_to_disk(self):
+        boundary = '--faKe_BoundaRy'
+        payloads = [os.urandom(300000) for _ in range(3)]
+        body = ''.join('%s\r\nContent-Type: a\r\n\r\n%s\r\n' % (boundary, p)
+                       for p in payloads) + boundary + '--'
+
+        # Reading the parts out of order keeps at most the threshold in
+        # memory per part, the rest is read back from disk
+        parts = [data for _, data in multipart.Parser(
+            boundary, io.BytesIO(body), block_size=8192,
+            max_buffer=3 * 10000, spool_threshold=10000,
+            spool_dir=tempfile.gettempdir())]
+        self.assertEqual([''.join(data) for data in reversed(parts)],
+                         list(reversed(payloads)))
+
+    def test_sink(self):
+        boundary = '------------------------------8f9710048d91'
+        expected = [''.join(data) for _, data in
+                    multipart.Parser(boundary, open('tests/fake_stream1.txt'))]
+        files = []
+
+        def sink(headers):
+            self.assertTrue(headers[0][0] == 'Content-Disposition')
+            # Every other part goes to a file
+            if len(files) % 2 == 0:
+                files.append(tempfile.TemporaryFile())
+                return files[-1]
+            files.append(None)
+            return None
+
+        for block_size in (3, 100, 1 << 20):
+            del files[:]
+            parts = [''.join(data) for _, data in
+                     multipart.Parser(boundary,
+                                      open('tests/fake_stream1.txt', 'rb'),
+                                      block_size=block_size, sink=sink)]
+            for i, fout in enumerate(files):
+                if fout is None:
+                    self.assertEqual(parts[i], expected[i])
+                else:
+                    self.assertEqual(parts[i], '')
+                    fout.seek(0)
+                    self.assertEqual(fout.read(), expected[i])
+
+    def test_release_gil(self):
+        boundary = '------------------------------8f9710048d91'
+        body = open('tests/fake_stream1.txt').read()
+        expected = [(list(headers), ''.join(data)) for headers, data in
+                    multipart.Parser(boundary, iter([body]))]
+
+        for size in (1, 5, 100, len(body)):
+            for min_chunk in (0, 1):
+                parts = [(list(headers), ''.join(data)) for headers, data in
+                         multipart.Parser(boundary, chunked(body, size),
+                                          min_chunk=min_chunk,
+                                          release_gil=True)]
+                self.assertEqual(parts, expected)
+
+        def bad():
+            for _ in multipart.Parser(boundary, iter([body[:80] + '\0']),
+                                      release_gil=True):
+                pass
+
+        self.assertRaises(ValueError, bad)
+
+    def test_mapped_input(self):
+        boundary = '------------------------------8f9710048d91'
+        path = 'tests/fake_stream1.txt'
+        body = open(path).read()
+        expected = [(list(headers), ''.join(data)) for headers, data in
+                    multipart.Parser(boundary, iter([body]))]
+
+        parts = [(list(headers), list(data)) for headers, data in
+                 multipart.Parser.from_path(path, boundary)]
+        for data in [data for _, chunks in parts for data in chunks]:
+            self.assertTrue(isinstance(data, buffer))
+        self.assertEqual([(headers, ''.join(map(str, data)))
+                          for headers, data in parts], expected)
+
+        parts = [(list(headers), ''.join(data)) for headers, data in
+                 multipart.Parser(boundary, body)]
+        self.assertEqual(parts, expected)
+
+        self.assertRaises(IOError, multipart.Parser.from_path,
+                          path + '.missing', boundary)
+
+    def test_digests(self):
+        boundary = '------------------------------8f9710048d91'
+        body = open('tests/fake_stream1.txt').read()
+
+        for size in (1, 63, 1000, len(body)):
+            parser = multipart.Parser(boundary, chunked(body, size),
+                                      digests=['md5', 'sha1', 'sha256'])
+            for headers, data in parser:
+                joined = ''.join(data)
+                self.assertEqual(data.digests, {
+                    'md5': hashlib.md5(joined).hexdigest(),
+                    'sha1': hashlib.sha1(joined).hexdigest(),
+                    'sha256': hashlib.sha256(joined).hexdigest()})
+
+        body = '--x\r\n\r\n123456789\r\n--x\r\n\r\n\r\n--x--'
+        parts = multipart.Parser('--x', iter([body]), digests=('crc32c',))
+        self.assertEqual([(''.join(data), data.digests) for _, data in parts],
+                         [('123456789', {'crc32c': 'e3069283'}),
+                          ('', {'crc32c': '00000000'})])
+        self.assertRaises(ValueError, multipart.Parser, '--x', iter([body]),
+                          digests=['md4'])
+
+    def test_decode_transfer_encoding(self):
+        rand = random.Random(15)
+        payload = ''.join(chr(rand.randrange(256)) for _ in range(3000))
+        encoded = base64.encodestring(payload).replace('\n', '\r\n')
+        quoted = binascii.b2a_qp(payload, istext=False)
+        quoted = quoted.replace('\n', '\r\n')
+        body = ('--x\r\nContent-Transfer-Encoding: base64\r\n\r\n%s\r\n'
+                '--x\r\ncontent-transfer-encoding: Quoted-Printable\r\n'
+                '\r\n%s\r\n--x\r\n\r\n%s\r\n--x--') % (encoded, quoted,
+                                                        encoded)
+
+        for size in (1, 3, 7, 1000, len(body)):
+            parts = [''.join(data) for _, data in
+                     multipart.Parser('--x', chunked(body, size), decode=True)]
+            self.assertEqual(parts, [payload, payload, encoded])
+
+        parts = [''.join(data) for _, data in
+                 multipart.Parser('--x', iter([body]))]
+        self.assertEqual(parts, [encoded, quoted, encoded])
+
+        #Spaces and tabs ending a line are transport padding
+        padded = ('--x\r\nContent-Transfer-Encoding: quoted-printable\r\n'
+                  '\r\na \t \r\nb=20 \r\nc \t=\r\nd \te  \n\t\r\nf  \r\n--x--')
+        for size in (1, 2, 5, len(padded)):
+            parts = [''.join(data) for _, data in
+                     multipart.Parser('--x', chunked(padded, size),
+                                      decode=True)]
+            self.assertEqual(parts, ['a\r\nb \r\nc \td \te\n\r\nf'])
+
+    def test_structured_headers(self):
+        body = ('--x\r\nContent-Disposition: form-data; name="a\\"b"\r\n'
+                '\r\nvalue\r\n--x\r\ncontent-disposition: form-data; '
+                'name=up; filename="rates.txt"; '
+                'filename*=UTF-8\'\'%E2%82%AC%20rates.txt\r\n'
+                'Content-Type: Text/Plain; charset="UTF-8"\r\n\r\n'
+                'data\r\n--x\r\n\r\n\r\n--x--')
+
+        for size in (1, 7, len(body)):
+            parts = [(headers, ''.join(data)) for headers, data in
+                     multipart.Parser('--x', chunked(body, size),
+                                      structured_headers=True)]
+            first, second, third = [headers for headers, _ in parts]
+            self.assertEqual([data for _, data in parts], ['value', 'data', ''])
+            self.assertTrue(isinstance(first, multipart.Headers))
+            self.assertEqual(first, {'content-disposition':
+                                     'form-data; name="a\\"b"'})
+            self.assertEqual((first.name, first.filename), ('a"b', None))
+            self.assertEqual(second.name, 'up')
+            self.assertEqual(second.filename, u'\u20ac rates.txt')
+            self.assertEqual(second.content_type, 'text/plain')
+            self.assertEqual(second.charset, 'utf-8')
+            self.assertEqual(second['content-type'], 'Text/Plain; charset="UTF-8"')
+            self.assertEqual((third, third.name, third.content_type),
+                             ({}, None, None))
+
+        repeated = ('--x\r\nContent-Disposition: form-data; name=a\r\n'
+                    'X-Tag: 1\r\ncontent-disposition: form-data; name=b\r\n'
+                    'x-tag: 2\r\nX-TAG: 3\r\n\r\ndata\r\n--x--')
+        [(headers, _)] = multipart.Parser('--x', iter([repeated]),
+                                          structured_headers=True)
+        self.assertEqual(headers, {'content-disposition':
+                                   ['form-data; name=a', 'form-data; name=b'],
+                                   'x-tag': ['1', '2', '3']})
+        self.assertEqual(headers.name, 'a')
+
+    def test_parts(self):
+        boundary = '------------------------------8f9710048d91'
+        body = open('tests/fake_stream1.txt').read()
+        expected = [(list(headers), ''.join(data)) for headers, data in
+                    multipart.Parser(boundary, iter([body]))]
+
+        for size in (1, 50, len(body)):
+            parts = list(multipart.Parser(boundary, chunked(body, size),
+                                          parts=True))
+            self.assertTrue(all(isinstance(part, multipart.Part)
+                                for part in parts))
+            self.assertEqual([(part.headers, ''.join(part)) for part in parts],
+                             expected)
+
+        # Dropped parts are recycled without leaking their headers or data
+        for _ in range(3):
+            names = [part.headers[0][1] for part in
+                     multipart.Parser(boundary, iter([body]), parts=True)]
+            self.assertEqual(names, [headers[0][1] for headers, _ in expected])
+
+        parser = multipart.Parser('--x', iter(['--x\r\na: 1\r\n\r\nv\r\n--x--']),
+                                  parts=True, structured_headers=True)
+        part = next(parser)
+        self.assertEqual((part.headers, list(part)), ({'a': '1'}, ['v']))
+
+    def test_eager_threshold(self):
+        big = 'b' * 5000
+        body = ('--x\r\nContent-Disposition: form-data; name="a"\r\n\r\n'
+                'small\r\n--x\r\n\r\n\r\n--x\r\n\r\n%s\r\n--x--' % big)
+
+        for size in (1, 100, len(body)):
+            parts = list(multipart.Parser('--x', chunked(body, size),
+                                          eager_threshold=100))
+            self.assertEqual([part.value for part in parts], ['small', '', None])
+            self.assertEqual([''.join(part) for part in parts],
+                             ['small', '', big])
+
+        self.assertRaises(ValueError, multipart.Parser, '--x', iter([body]),
+                          eager_threshold=-1)
+
+    def test_limits(self):
+        body = ('--x\r\nContent-Type: text/plain\r\nX-Other: y\r\n\r\n'
+                'first value\r\n--x\r\n\r\nsecond\r\n--x--')
+
+        def parse(size, **limits):
+            return [(list(headers), ''.join(data)) for headers, data in
+                    multipart.Parser('--x', chunked(body, size), **limits)]
+
+        expected = parse(len(body))
+        cases = [('max_header_bytes', 30, 35), ('max_headers_per_part', 1, 38),
+                 ('max_parts', 1, 62), ('max_part_bytes', 10, 55),
+                 ('max_total_bytes', 50, 50)]
+
+        for size in (1, 9, len(body)):
+            for limit, value, offset in cases:
+                self.assertEqual(parse(size, **{limit: value + 100}), expected)
+                try:
+                    parse(size, **{limit: value})
+                except multipart.LimitError as error:
+                    self.assertEqual((error.limit, error.offset), (limit, offset))
+                    self.assertTrue(isinstance(error, ValueError))
+                else:
+                    self.fail('%s was not enforced' % limit)
+
+        self.assertEqual(parse(len(body), max_total_bytes=len(body)), expected)
+        self.assertRaises(ValueError, multipart.Parser, '--x', iter([body]),
+                          max_parts=-1)
+
+    def test_long_headers(self):
+        headers = [('X-Header-' + name, 'v' * (i * 300))
+                   for i, name in enumerate('abcde')]
+        part = ''.join('%s: %s\r\n' % header for header in headers)
+        body = '--x\r\n%s\r\ndata\r\n--x\r\n%s\r\n\r\n--x--' % (part, part)
+
+        for size in (1, 100, len(body)):
+            parts = [(list(h), ''.join(d)) for h, d in
+                     multipart.Parser('--x', chunked(body, size))]
+            self.assertEqual(parts, [(headers, 'data'), (headers, '')])
+
+    def test_push_parser(self):
+        boundary = '------------------------------8f9710048d91'
+        body = open('tests/fake_stream1.txt').read()
+        expected = [(list(headers), ''.join(data)) for headers, data in
+                    multipart.Parser(boundary, iter([body]))]
+
+        for size in (1, 3, 64, len(body)):
+            parser = multipart.PushParser(boundary)
+            parts = []
+            for chunk in chunked(body, size):
+                for event in parser.feed(chunk):
+                    if event[0] == multipart.PART_BEGIN:
+                        parts.append(([], []))
+                    elif event[0] == multipart.HEADER:
+                        parts[-1][0].append(event[1:])
+                    elif event[0] == multipart.DATA:
+                        parts[-1][1].append(chunk[event[1]:event[1] + event[2]])
+                    elif event[0] == multipart.DATA_BYTES:
+                        parts[-1][1].append(event[1])
+            parser.close()
+            self.assertTrue(parser.done)
+            self.assertEqual([(h, ''.join(d)) for h, d in parts], expected)
+
+        parser = multipart.PushParser(boundary)
+        parser.feed(body[:100])
+        self.assertRaises(ValueError, parser.close)
+        self.assertRaises(ValueError, multipart.PushParser('--x').feed, 'nonsense')
+        self.assertRaises(multipart.LimitError,
+                          multipart.PushParser(boundary, max_parts=1).feed, body)
+
+    def test_encoder(self):
+        payload = os.urandom(300000)
+        upload = tempfile.TemporaryFile()
+        upload.write('skipped' + payload)
+        upload.seek(len('skipped'))
+        parts = [([('Content-Disposition', 'form-data; name="a"')], 'value'),
+                 ([('Content-Disposition', 'form-data; name="b"'),
+                   ('Content-Type', 'application/octet-stream')], upload),
+                 ([], io.BytesIO('from read')),
+                 ([], bytearray('x' * 100)),
+                 ([], payload)]
+        expected = [(headers, str(body) if not hasattr(body, 'read') else
+                     payload if body is upload else 'from read')
+                    for headers, body in parts]
+
+        encoder = multipart.Encoder(parts, chunk_size=64 * 1024)
+        self.assertEqual(encoder.content_type,
+                         'multipart/form-data; boundary=' + encoder.boundary)
+        body = ''.join(encoder)
+        self.assertEqual(encoder.content_length, len(body))
+        self.assertTrue(all(len(chunk) <= 300000 for chunk in encoder))
+        self.assertEqual(multipart.parse_all('--' + encoder.boundary, body),
+                         expected)
+
+        # The file's position is left alone, so the body can be written again
+        for chunk_size in (1000, 1 << 20):
+            out = tempfile.TemporaryFile()
+            encoder = multipart.Encoder(parts[:2], boundary='fixed',
+                                        chunk_size=chunk_size)
+            self.assertEqual(encoder.write_to(out), encoder.content_length)
+            out.seek(0)
+            self.assertEqual(multipart.parse_all('--fixed', out.read()),
+                             expected[:2])
+
+        read, write = os.pipe()
+        os.write(write, 'piped')
+        os.close(write)
+        encoder = multipart.Encoder([([], os.fdopen(read))], boundary='p')
+        self.assertEqual(encoder.content_length, None)
+        self.assertEqual(''.join(encoder), '--p\r\n\r\npiped\r\n--p--\r\n')
+
+        self.assertRaises(ValueError, multipart.Encoder,
+                          [([('X', 'a\r\nInjected: 1')], '')])
+        self.assertRaises(TypeError, multipart.Encoder, [([], u'text')])
+
+        # Boundaries are limited to what RFC 2046 allows, and quoted in the
+        # Content-Type header when they hold separators
+        for boundary in ('a\r\nX: 1', 'a"b', 'end ', '', 'x' * 71):
+            self.assertRaises(ValueError, multipart.Encoder, [([], 'v')],
+                              boundary=boundary)
+        encoder = multipart.Encoder([([], 'v')], boundary="a b:c=(d)?")
+        self.assertEqual(encoder.content_type,
+                         'multipart/form-data; boundary="a b:c=(d)?"')
+        self.assertEqual(multipart.parse_all('--a b:c=(d)?', ''.join(encoder)),
+                         [([], 'v')])
+
+        # Content holding a chosen boundary would split the part
+        for part in ([], 'a\r\n--fixed\r\nb'), ([('X', '--fixed')], ''):
+            self.assertRaises(ValueError, multipart.Encoder, [part],
+                              boundary='fixed')
+        encoder = multipart.Encoder([([], '-fixed--fixe')], boundary='fixed')
+        self.assertRaises(RuntimeError, encoder.__init__, [])
+
+        # write_to carries on where iteration stopped
+        for seekable in (True, False):
+            if seekable:
+                upload = tempfile.TemporaryFile()
+                upload.write(payload)
+                upload.seek(0)
+            else:
+                read, write = os.pipe()
+                os.write(write, payload[:50000])
+                os.close(write)
+                upload = os.fdopen(read)
+            encoder = multipart.Encoder([([], upload), ([], 'x')],
+                                        boundary='p', chunk_size=1000)
+            head = next(encoder) + next(encoder)
+            out = tempfile.TemporaryFile()
+            written = encoder.write_to(out)
+            out.seek(0)
+            body = head + out.read()
+            self.assertEqual(written + len(head), len(body))
+            self.assertEqual(multipart.parse_all('--p', body),
+                             [([], payload if seekable else payload[:50000]),
+                              ([], 'x')])
+            self.assertRaises(StopIteration, next, encoder)
+
+    def test_parse_all(self):
+        boundary = '------------------------------8f9710048d91'
+        body = open('tests/fake_stream1.txt').read()
+        expected = [(list(headers), ''.join(data)) for headers, data in
+                    multipart.Parser(boundary, iter([body]))]
+
+        self.assertEqual(multipart.parse_all(boundary, body), expected)
+        self.assertEqual(multipart.parse_all(boundary, buffer(body)), expected)
+        self.assertRaises(ValueError, multipart.parse_all, boundary, body[:80])
+        self.assertRaises(ValueError, multipart.parse_all, '--x', 'nonsense')
+
+    def test_parse_many(self):
+        boundary = '------------------------------8f9710048d91'
+        body = open('tests/fake_stream1.txt').read()
+        expected = [(list(headers), ''.join(data)) for headers, data in
+                    multipart.Parser(boundary, iter([body]))]
+
+        for workers in (0, 1, 3):
+            results = multipart.parse_many([(boundary, body)] * 10,
+                                           workers=workers)
+            self.assertEqual(results, [expected] * 10)
+
+        # More workers than CPUs are not each given a thread
+        results = multipart.parse_many([(boundary, body)] * 2000,
+                                       workers=100000)
+        self.assertEqual(results, [expected] * 2000)
+
+        # Bodies are held while the workers run, whatever their type
+        results = multipart.parse_many(iter([(boundary, bytearray(body)),
+                                             (boundary, buffer(body))]))
+        self.assertEqual(results, [expected] * 2)
+
+        self.assertEqual(multipart.parse_many([]), [])
+        self.assertRaises(ValueError, multipart.parse_many,
+                          [(boundary, body), (boundary, body[:80])])
+        self.assertRaises(TypeError, multipart.parse_many, [body])
+
+    def test_parse_parallel(self):
+        boundary = '--parallel'
+        rand = random.Random(12)
+        noise = ''.join(rand.choice('ab\r\n-') for _ in range(1000))
+        parts = [(noise * 300)[i:i + size]
+                 for i, size in enumerate([0, 7, 300000] * 12)]
+        body = ''.join('%s\r\nContent-Disposition: form-data; name="f%d"\r\n'
+                       '\r\n%s\r\n' % (boundary, i, data)
+                       for i, data in enumerate(parts)) + boundary + '--\r\n'
+        expected = [(list(headers), ''.join(data)) for headers, data in
+                    multipart.Parser(boundary, iter([body]))]
+
+        for workers in (0, 1, 3):
+            result = multipart.parse_parallel(boundary, body, workers=workers)
+            self.assertEqual([(headers, str(data)) for headers, data in result],
+                             expected)
+            self.assertTrue(all(isinstance(data, buffer) for _, data in result))
+
+        # A bytearray is held so it cannot be resized while it is searched
+        result = multipart.parse_parallel(boundary, bytearray(body), workers=3)
+        self.assertEqual([(headers, str(data)) for headers, data in result],
+                         expected)
+
+        # Data that starts with the boundary right after the headers is
+        # not a delimiter, and neither is a header line that starts with it
+        for data in ('--qqa-', '--q--', '--q-\x00\r\nx', '--q\r\n-'):
+            for headers in ('', 'A-zxx-x: ca\r\n', 'A: b\r\n--q: c\r\n'):
+                tricky = ('--q\r\n\r\nb\r\n--q\r\n%s\r\n%s\r\n--q--'
+                          % (headers, data))
+                result = multipart.parse_parallel('--q', tricky)
+                self.assertEqual([(h, str(d)) for h, d in result],
+                                 multipart.parse_all('--q', tricky))
+
+        self.assertRaises(ValueError, multipart.parse_parallel, boundary,
+                          body[:-4])
+        self.assertRaises(ValueError, multipart.parse_parallel, boundary,
+                          'x' + body)
+
 
 if __name__ == '__main__':
     unittest.main()